@@ -0,0 +1,322 @@
+#include "analysis.h"
+#include "hash.h"
+#include "cpu.h"
+#include <string.h>
+
+#define HISTORY_SIZE 16
+
+// traversal state, the worklist holds cpu addresses still to be walked
+typedef struct Walker {
+    const ROM *rom;
+    Analysis *analysis;
+    uint8_t *leaders;       // prg bitmap of block starts
+    uint16_t *work;
+    unsigned work_count;
+    unsigned work_capacity;
+    unsigned history[HISTORY_SIZE]; // prg offsets of the current straight-line run, newest last
+    unsigned history_count;
+    unsigned table_capacity;
+} Walker;
+
+static bool test_bit(const uint8_t *bitmap, unsigned bit) {
+    return bitmap[bit / 8] & (1 << (bit % 8));
+}
+
+static void mark_bit(uint8_t *bitmap, unsigned bit) {
+    bitmap[bit / 8] |= 1 << (bit % 8);
+}
+
+static unsigned bitmap_size(unsigned bits) {
+    return (bits + 7) / 8;
+}
+
+static void push_work(Walker *walker, uint16_t addr) {
+    if (addr < PRG_ROM_START) { // code copied to ram is out of reach statically
+        return;
+    }
+    mark_bit(walker->leaders, prg_offset(walker->rom, addr));
+    if (walker->work_count == walker->work_capacity) {
+        walker->work_capacity = walker->work_capacity ? walker->work_capacity * 2 : 64;
+        walker->work = (uint16_t*) realloc(walker->work, walker->work_capacity * sizeof(uint16_t));
+    }
+    walker->work[walker->work_count++] = addr;
+}
+
+static uint16_t read_prg16(const ROM *rom, uint16_t addr) {
+    return read_prg(rom, addr) | (read_prg(rom, addr + 1) << 8);
+}
+
+// jmp (indirect) through a rom vector, the pointer's high byte is fetched without leaving its page like the cpu does
+static uint16_t vector_target(const ROM *rom, uint16_t ptr) {
+    return read_prg(rom, ptr) | (read_prg(rom, (ptr & 0xff00) | ((ptr + 1) & 0xff)) << 8);
+}
+
+static bool is_branch(const Inst *inst) {
+    return inst->addr_mode == RELATIVE;
+}
+
+static uint16_t branch_target(const Inst *inst, uint16_t addr) {
+    return addr + inst->size_bytes + (int8_t) inst->body[0];
+}
+
+static uint16_t operand_addr(const Inst *inst) {
+    return (inst->body[1] << 8) | inst->body[0];
+}
+
+// base of the closest indexed rom load before history position end, 0 when there is none
+static uint16_t indexed_load_before(const Walker *walker, unsigned end) {
+    for (unsigned i = end; i-- > 0;) {
+        const Inst *inst = &walker->rom->prg_inst[walker->history[i]];
+        if (inst->inst_type == LDA_OP && (inst->addr_mode == ABSOLUTE_X || inst->addr_mode == ABSOLUTE_Y) &&
+                operand_addr(inst) >= PRG_ROM_START) {
+            return operand_addr(inst);
+        }
+    }
+    return 0;
+}
+
+// recognizes the two usual dispatch idioms ending the current run:
+//   lda lo,x / sta ptr / lda hi,x / sta ptr+1 / jmp (ptr)
+//   lda hi,x / pha / lda lo,x / pha / rts
+static void find_jump_table(Walker *walker, uint16_t dispatch, const Inst *inst) {
+    bool rts = inst->inst_type == RTS_OP;
+    uint16_t ptr = operand_addr(inst);
+    uint16_t lo = 0;
+    uint16_t hi = 0;
+    unsigned pushes = 0;
+
+    for (unsigned i = walker->history_count; i-- > 0 && !(lo && hi);) {
+        const Inst *prev = &walker->rom->prg_inst[walker->history[i]];
+        if (rts && prev->inst_type == PHA_OP) {
+            uint16_t base = indexed_load_before(walker, i);
+            if (pushes++ == 0) { // last push is the low byte
+                lo = base;
+            } else {
+                hi = base;
+            }
+        } else if (!rts && prev->inst_type == STA_OP && (prev->addr_mode == ZERO_PAGE || prev->addr_mode == ABSOLUTE)) {
+            uint16_t dest = prev->addr_mode == ZERO_PAGE ? prev->body[0] : operand_addr(prev);
+            if (dest == ptr && !lo) {
+                lo = indexed_load_before(walker, i);
+            } else if (dest == (uint16_t) (ptr + 1) && !hi) {
+                hi = indexed_load_before(walker, i);
+            }
+        }
+    }
+    if (!lo || !hi) {
+        return;
+    }
+
+    JumpTable table = {dispatch, lo, hi, 0, hi == lo + 1 ? 2 : 1, rts};
+    const ROM *rom = walker->rom;
+    const Analysis *analysis = walker->analysis;
+    for (unsigned i = 0; i < MAX_JUMP_TABLE_ENTRIES; i++) {
+        unsigned lo_addr = lo + i * table.stride;
+        unsigned hi_addr = hi + i * table.stride;
+        if (hi_addr > 0xffff || lo_addr > 0xffff || (table.stride == 1 && lo < hi && lo_addr >= hi)) {
+            break;
+        }
+        if (test_bit(analysis->code, prg_offset(rom, lo_addr)) || test_bit(analysis->code, prg_offset(rom, hi_addr))) {
+            break; // ran into code, the table has ended
+        }
+        uint16_t target = (read_prg(rom, lo_addr) | (read_prg(rom, hi_addr) << 8)) + rts;
+        if (target < PRG_ROM_START) {
+            break;
+        }
+        push_work(walker, target);
+        table.entries++;
+    }
+    if (!table.entries) {
+        return;
+    }
+
+    Analysis *out = walker->analysis;
+    if (out->table_count == walker->table_capacity) {
+        walker->table_capacity = walker->table_capacity ? walker->table_capacity * 2 : 8;
+        out->tables = (JumpTable*) realloc(out->tables, walker->table_capacity * sizeof(JumpTable));
+    }
+    out->tables[out->table_count++] = table;
+}
+
+// follows one straight-line run of instructions, queueing every other way control can go
+static void walk(Walker *walker, uint16_t addr) {
+    const ROM *rom = walker->rom;
+    Analysis *analysis = walker->analysis;
+    walker->history_count = 0;
+
+    for (;;) {
+        unsigned offset = prg_offset(rom, addr);
+        if (test_bit(analysis->starts, offset)) { // joined code walked before
+            mark_bit(walker->leaders, offset);
+            return;
+        }
+        const Inst *inst = &rom->prg_inst[offset];
+        mark_bit(analysis->starts, offset);
+        for (unsigned i = 0; i < inst->size_bytes; i++) {
+            mark_bit(analysis->code, prg_offset(rom, addr + i));
+        }
+        if (walker->history_count == HISTORY_SIZE) {
+            memmove(walker->history, walker->history + 1, (HISTORY_SIZE - 1) * sizeof(unsigned));
+            walker->history_count--;
+        }
+        walker->history[walker->history_count++] = offset;
+
+        uint16_t next = addr + inst->size_bytes;
+        if (is_branch(inst)) {
+            push_work(walker, branch_target(inst, addr));
+            push_work(walker, next);
+            return;
+        }
+        switch (inst->inst_type) {
+            case JMP_OP:
+                if (inst->addr_mode == ABSOLUTE) {
+                    push_work(walker, operand_addr(inst));
+                } else if (operand_addr(inst) >= PRG_ROM_START) { // constant vector in rom
+                    push_work(walker, vector_target(rom, operand_addr(inst)));
+                } else {
+                    find_jump_table(walker, addr, inst);
+                }
+                return;
+            case JSR_OP:
+                push_work(walker, operand_addr(inst));
+                push_work(walker, next);
+                return;
+            case RTS_OP:
+                find_jump_table(walker, addr, inst);
+                return;
+            case RTI_OP:
+            case BRK_OP:
+                return;
+            default:
+                break;
+        }
+        if (next < addr || next < PRG_ROM_START) { // ran off the end of the address space
+            return;
+        }
+        addr = next;
+    }
+}
+
+static bool ends_block(const Inst *inst) {
+    return is_branch(inst) || inst->inst_type == JMP_OP || inst->inst_type == JSR_OP ||
+        inst->inst_type == RTS_OP || inst->inst_type == RTI_OP || inst->inst_type == BRK_OP;
+}
+
+static void build_block(const Walker *walker, unsigned offset, Block *block) {
+    const ROM *rom = walker->rom;
+    uint16_t addr = prg_address(rom, offset);
+    memset(block, 0, sizeof(Block));
+    block->start = addr;
+
+    for (;;) {
+        const Inst *inst = &rom->prg_inst[prg_offset(rom, addr)];
+        uint16_t next = addr + inst->size_bytes;
+        block->insts++;
+        block->max_cycles += inst->cycles + inst->page_cross_cycles + inst->branch_succeeds_cycles;
+
+        if (ends_block(inst)) {
+            if (is_branch(inst)) {
+                block->exit = EXIT_BRANCH;
+                block->targets[0] = branch_target(inst, addr);
+                block->targets[1] = next;
+            } else if (inst->inst_type == JSR_OP) {
+                block->exit = EXIT_CALL;
+                block->targets[0] = operand_addr(inst);
+                block->targets[1] = next;
+            } else if (inst->inst_type == JMP_OP && inst->addr_mode == ABSOLUTE) {
+                block->exit = EXIT_JUMP;
+                block->targets[0] = operand_addr(inst);
+            } else if (inst->inst_type == JMP_OP && operand_addr(inst) >= PRG_ROM_START) {
+                block->exit = EXIT_JUMP;
+                block->targets[0] = vector_target(rom, operand_addr(inst));
+            } else if (inst->inst_type == JMP_OP) {
+                block->exit = EXIT_INDIRECT;
+            } else {
+                block->exit = EXIT_RETURN;
+            }
+            block->end = next;
+            return;
+        }
+
+        unsigned next_offset = prg_offset(rom, next);
+        if (next < addr || next < PRG_ROM_START || test_bit(walker->leaders, next_offset) ||
+                !test_bit(walker->analysis->starts, next_offset) || block->insts == UINT8_MAX) {
+            block->exit = EXIT_FALLTHROUGH;
+            block->targets[1] = next;
+            block->end = next;
+            return;
+        }
+        addr = next;
+    }
+}
+
+// recursive traversal from the reset, nmi and irq vectors of the last prg bank
+Analysis *analyze_rom(const ROM *rom) {
+    Analysis *analysis = (Analysis*) calloc(1, sizeof(Analysis));
+    analysis->rom_hash = rom_hash(rom);
+    analysis->prg_len = rom->prg_len;
+    analysis->code = (uint8_t*) calloc(bitmap_size(rom->prg_len) + 1, 1);
+    analysis->starts = (uint8_t*) calloc(bitmap_size(rom->prg_len) + 1, 1);
+    if (!rom->prg_len || !rom->inst_amount || rom->prg_len > PRG_WINDOW_SIZE) { // no mapper to follow bank switches
+        return analysis;
+    }
+
+    Walker walker = {rom, analysis, (uint8_t*) calloc(bitmap_size(rom->prg_len), 1)};
+    push_work(&walker, read_prg16(rom, RESET_VECTOR));
+    push_work(&walker, read_prg16(rom, NMI_VECTOR));
+    push_work(&walker, read_prg16(rom, IRQ_VECTOR));
+    while (walker.work_count) {
+        walk(&walker, walker.work[--walker.work_count]);
+    }
+
+    unsigned capacity = 0;
+    for (unsigned offset = 0; offset < rom->prg_len; offset++) {
+        if (!test_bit(walker.leaders, offset) || !test_bit(analysis->starts, offset)) {
+            continue;
+        }
+        if (analysis->block_count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            analysis->blocks = (Block*) realloc(analysis->blocks, capacity * sizeof(Block));
+        }
+        build_block(&walker, offset, &analysis->blocks[analysis->block_count++]);
+    }
+
+    free(walker.leaders);
+    free(walker.work);
+    return analysis;
+}
+
+void delete_analysis(Analysis *analysis) {
+    if (analysis->mapped) {
+        free(analysis);
+        return;
+    }
+    free(analysis->code);
+    free(analysis->starts);
+    free(analysis->blocks);
+    free(analysis->tables);
+    free(analysis);
+}
+
+bool is_code(const Analysis *analysis, const ROM *rom, uint16_t addr) {
+    return addr >= PRG_ROM_START && rom->prg_len && test_bit(analysis->code, prg_offset(rom, addr));
+}
+
+// block starting at addr, NULL when addr is not a known block start
+const Block *find_block(const Analysis *analysis, uint16_t addr) {
+    if (addr < PRG_ROM_START || !analysis->prg_len || analysis->prg_len > PRG_WINDOW_SIZE) {
+        return NULL;
+    }
+    addr = 0x10000 - analysis->prg_len + (addr - PRG_ROM_START) % analysis->prg_len; // blocks use the top mirror
+    unsigned low = 0;
+    unsigned high = analysis->block_count;
+    while (low < high) {
+        unsigned mid = (low + high) / 2;
+        if (analysis->blocks[mid].start < addr) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low < analysis->block_count && analysis->blocks[low].start == addr ? &analysis->blocks[low] : NULL;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "rom.h"
+
+#define MAX_JUMP_TABLE_ENTRIES 128
+
+// how control leaves a basic block
+typedef enum BLOCK_EXIT {
+    EXIT_FALLTHROUGH,   // next instruction starts another block
+    EXIT_BRANCH,        // conditional branch, target and fall-through
+    EXIT_JUMP,          // jmp absolute or constant indirect
+    EXIT_CALL,          // jsr, assumed to return to the fall-through
+    EXIT_RETURN,        // rts, rti or brk
+    EXIT_INDIRECT       // jmp through ram, targets only known through a jump table
+} BLOCK_EXIT;
+
+typedef struct Block {
+    uint16_t start;         // cpu address of first instruction
+    uint16_t end;           // cpu address one past the last instruction
+    uint16_t targets[2];    // jump, branch or call target then fall-through, 0 when absent
+    uint16_t max_cycles;    // worst case with every page cross and the branch taken
+    uint8_t insts;
+    uint8_t exit;           // BLOCK_EXIT
+} Block;
+
+// address table consumed by a computed jump, split into low and high byte tables
+typedef struct JumpTable {
+    uint16_t dispatch;      // jmp (indirect) or rts that consumes the table
+    uint16_t lo;            // address of first low byte
+    uint16_t hi;            // address of first high byte
+    uint16_t entries;
+    uint8_t stride;         // 2 when low and high bytes are interleaved words, 1 for split tables
+    bool rts;               // pushed for rts, so targets are one past each entry
+} JumpTable;
+
+// static control flow of the prg reachable from the vectors, prg bitmaps are indexed by prg offset
+typedef struct Analysis {
+    uint64_t rom_hash;
+    unsigned prg_len;
+    uint8_t *code;          // bytes of reached instructions, everything else is data or unreached
+    uint8_t *starts;        // first bytes of reached instructions
+    Block *blocks;          // sorted by start
+    unsigned block_count;
+    JumpTable *tables;
+    unsigned table_count;
+    bool mapped;            // sections live in a rom cache mapping owned by the rom
+} Analysis;
+
+Analysis *analyze_rom(const ROM *rom);
+void delete_analysis(Analysis *analysis);
+bool is_code(const Analysis *analysis, const ROM *rom, uint16_t addr);
+const Block *find_block(const Analysis *analysis, uint16_t addr);
@@ -0,0 +1,33 @@
+#include "apu.h"
+#include "nes.h"
+#include <stdlib.h>
+
+// $4015 read, reports and acknowledges the frame interrupt
+uint8_t apu_read_status(NES *nes) {
+    uint8_t value = nes->apu.frame_irq << 6;
+    nes->apu.frame_irq = false;
+    nes->irq_lines &= ~IRQ_APU_FRAME;
+    return value;
+}
+
+// $4017 write, restarts the frame counter sequence
+void apu_write_frame_counter(NES *nes, uint8_t value) {
+    nes->apu.five_step_mode = get_bit(value, 7);
+    nes->apu.irq_inhibit = get_bit(value, 6);
+    if (nes->apu.irq_inhibit) {
+        nes->apu.frame_irq = false;
+        nes->irq_lines &= ~IRQ_APU_FRAME;
+    }
+
+    // 5-step sequence never raises an interrupt
+    schedule_component(nes, COMPONENT_APU, nes->apu.five_step_mode ? NO_EVENT : nes->cpu.cycles + APU_FRAME_IRQ_FIRST_DELAY);
+}
+
+// end of 4-step sequence, time is the cycle it was due, returns when the next one is
+uint64_t apu_frame_irq(NES *nes, uint64_t time) {
+    if (!nes->apu.irq_inhibit) {
+        nes->apu.frame_irq = true;
+        nes->irq_lines |= IRQ_APU_FRAME;
+    }
+    return time + APU_FRAME_IRQ_PERIOD;
+}
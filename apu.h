@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define APU_FRAME_IRQ_PERIOD 29830      // cpu cycles per 4-step frame counter sequence
+#define APU_FRAME_IRQ_FIRST_DELAY 29829 // cpu cycles from $4017 write to first frame irq
+
+typedef struct NES NES;
+
+// frame counter only, sound channels are not emulated yet
+typedef struct APU {
+    bool five_step_mode; // $4017 bit 7
+    bool irq_inhibit;    // $4017 bit 6
+    bool frame_irq;      // frame interrupt flag, read and cleared through $4015
+} APU;
+
+uint8_t apu_read_status(NES *nes);
+void apu_write_frame_counter(NES *nes, uint8_t value);
+uint64_t apu_frame_irq(NES *nes, uint64_t time);
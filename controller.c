@@ -0,0 +1,15 @@
+#include "controller.h"
+
+// serial read through $4016/$4017, reports one button per read, then 1s once all 8 are read
+uint8_t read_controller(Controller *controller, bool strobe) {
+    if (strobe) {
+        latch_controller(controller);
+    }
+    uint8_t value = controller->shift & 1;
+    controller->shift = (controller->shift >> 1) | 0x80;
+    return value | 0x40; // upper bits are open bus, usually the $40 of the address
+}
+
+void latch_controller(Controller *controller) {
+    controller->shift = controller->buttons;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef enum CONTROLLER_BUTTON {
+    BUTTON_A = 0,
+    BUTTON_B = 1,
+    BUTTON_SELECT = 2,
+    BUTTON_START = 3,
+    BUTTON_UP = 4,
+    BUTTON_DOWN = 5,
+    BUTTON_LEFT = 6,
+    BUTTON_RIGHT = 7
+} CONTROLLER_BUTTON;
+
+// standard joypad, buttons are latched into a shift register while strobe is high
+typedef struct Controller {
+    uint8_t buttons; // currently held buttons, bit per CONTROLLER_BUTTON
+    uint8_t shift;   // latched buttons not yet read out
+} Controller;
+
+uint8_t read_controller(Controller *controller, bool strobe);
+void latch_controller(Controller *controller);
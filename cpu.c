@@ -1,12 +1,54 @@
 #include "cpu.h"
+#include "nes.h"
+#include "fusion.h"
+#include "cycle.h"
 
-// initialization of cpu upon NES boot
-CPU *new_CPU() {
-    CPU *cpu = (CPU*) calloc(1, sizeof(CPU)); // zero-initialize values
+// power-up register values, the rest of the zeroed cpu is left as is
+void power_on_cpu(CPU *cpu) {
     cpu->stack_p = 0xfd; // initialize descending, empty stack
     cpu->status_reg = 0x0034;
+}
+
+// loads program counter from reset vector, registers other than stack pointer and irq disable are kept
+void reset_cpu(NES *nes) {
+    nes->cpu.stack_p -= 3;
+    set_cpu_status_bit(&nes->cpu, IRQ_DISABLE, 1);
+    nes->cpu.program_c = read_mem16(nes, RESET_VECTOR);
+    nes->cpu.cycles += 7;
+}
 
-    return cpu;
+// hardware interrupt, pushes return address and status then jumps through vector
+void cpu_interrupt(NES *nes, uint16_t vector) {
+    stack_push16(nes, nes->cpu.program_c);
+    stack_push(nes, (nes->cpu.status_reg & ~(1 << BRK)) | (1 << UNUSED)); // brk flag only set when pushed by instruction
+    set_cpu_status_bit(&nes->cpu, IRQ_DISABLE, 1);
+    nes->cpu.program_c = read_mem16(nes, vector);
+    nes->cpu.cycles += 7;
+}
+
+// fetches instruction at program counter, advances past it and executes it, returns cycles taken
+unsigned step_cpu(NES *nes) {
+    Inst decoded;
+    return issue_inst(nes, fetch_inst(nes, nes->cpu.program_c, &decoded));
+}
+
+// executes an instruction already fetched from the program counter
+unsigned issue_inst(NES *nes, const Inst *inst) {
+    if (inst->fused) { // breakpoints are flagged as a fusion so unflagged instructions pay no extra test
+        if (inst->fused == FUSE_BREAKPOINT) {
+            halt_nes(nes, NES_DEBUG_STOP);
+            return 0;
+        }
+        if (!nes->rom->cycle_stepped && nes->cpu.cycles + inst->cycles < nes->batch_end && // second half still runs before next event
+                !(nes->watches && nes->watches->pages[0])) { // fused pairs access zero page directly
+            return exec_fused(nes, inst);
+        }
+    }
+    if (nes->rom->cycle_stepped) {
+        return issue_inst_cycles(nes, inst);
+    }
+    nes->cpu.program_c += inst->size_bytes;
+    return exec_inst(nes, inst);
 }
 
 inline void set_cpu_status_bit(CPU *cpu, STATUS_REG_BIT bit_position, bool value) {
@@ -30,22 +72,30 @@ inline void set_bit(uint8_t *byte, unsigned pos, bool value) {
 }
 
 void stack_push(NES *nes, uint8_t value) {
-    nes->ram[nes->cpu->stack_p--] = value;
+    if (nes->watches && nes->watches->pages[STACK_PAGE >> 8]) {
+        watch_write(nes, STACK_PAGE | nes->cpu.stack_p, value);
+    }
+    nes->ram[STACK_PAGE | nes->cpu.stack_p--] = value;
+    mark_ram_dirty(nes, STACK_PAGE);
 }
 
 void stack_push16(NES *nes, uint16_t value) {
-    stack_push(nes, (uint8_t) value); // truncate for least significant byte
     stack_push(nes, (uint8_t) (value >> 8)); // push most significant byte
+    stack_push(nes, (uint8_t) value); // truncate for least significant byte
 }
 
 uint8_t stack_pull(NES *nes) { // pull = pop in 6502 lingo
-    return nes->ram[++nes->cpu->stack_p];
+    uint8_t value = nes->ram[STACK_PAGE | ++nes->cpu.stack_p];
+    if (nes->watches && nes->watches->pages[STACK_PAGE >> 8]) {
+        watch_read(nes, STACK_PAGE | nes->cpu.stack_p, value);
+    }
+    return value;
 }
 
 uint16_t stack_pull16(NES *nes) {
     uint8_t pull0 = stack_pull(nes);
     uint8_t pull1 = stack_pull(nes);
-    uint16_t result = (pull0 << 8) | pull1;
+    uint16_t result = (pull1 << 8) | pull0;
     return result;
 }
 
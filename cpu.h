@@ -2,20 +2,29 @@
 
 #include <stdint.h>
 #include <stdbool.h>
-#include "nes.h"
 #include "instruction.h"
 
 #define CPU_CLOCK 21441960
 
+#define STACK_PAGE 0x0100
+#define NMI_VECTOR 0xfffa
+#define RESET_VECTOR 0xfffc
+#define IRQ_VECTOR 0xfffe
+
 typedef struct NES NES;
+typedef struct Inst Inst;
 
 typedef struct CPU {
     uint8_t acc_reg;    // accumulator register
     uint8_t x_reg;      // x tiling register
     uint8_t y_reg;      // y tiling register
-    uint8_t status_reg; // status register [NEGATIVE | OVERFLOW | | BRK COMMAND | DECIMAL MODE (NOT USED) | IRQ DISABLE | ZERO | CARRY]
+    uint8_t status_reg; // status register [NEGATIVE | OVERFLOW | (UNUSED) | BRK COMMAND | DECIMAL MODE (NOT USED) | IRQ DISABLE | ZERO | CARRY]
     uint8_t stack_p;   // stack pointer
     uint16_t program_c; // program counter
+    uint64_t cycles;    // cpu cycles elapsed since power-on
+    uint64_t insts;     // instructions retired since power-on
+    uint16_t operand_val;      // scratch: value of operand used by executing instruction (memory locations accessed, jump relative distance)
+    uint16_t operand_mem_addr; // scratch: memory address of operand for stores
 } CPU;
 
 typedef enum STATUS_REG_BIT {
@@ -24,11 +33,16 @@ typedef enum STATUS_REG_BIT {
     IRQ_DISABLE = 2,
     DECIMAL = 3,
     BRK = 4,
-    OVERFLOW = 5,
-    NEGATIVE = 6
+    UNUSED = 5,
+    OVERFLOW = 6,
+    NEGATIVE = 7
 } STATUS_REG_BIT;
 
-CPU *new_CPU();
+void power_on_cpu(CPU *cpu);
+void reset_cpu(NES *nes);
+void cpu_interrupt(NES *nes, uint16_t vector);
+unsigned step_cpu(NES *nes);
+unsigned issue_inst(NES *nes, const Inst *inst);
 void set_cpu_status_bit(CPU *cpu, STATUS_REG_BIT bit_position, bool value);
 bool get_cpu_status_bit(CPU *cpu, STATUS_REG_BIT bit_position);
 bool get_bit(uint8_t byte, unsigned pos);
@@ -0,0 +1,207 @@
+#include "cycle.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// how an instruction uses the memory its operand addresses
+typedef enum ACCESS {
+    ACCESS_NONE,    // registers, stack and program counter only, none of which has side effects
+    ACCESS_READ,
+    ACCESS_WRITE,
+    ACCESS_MODIFY   // read, write back unchanged, then write the result
+} ACCESS;
+
+static ACCESS inst_access(const Inst *inst) {
+    switch (inst->addr_mode) {
+        case IMPLIED:
+        case ACCUMULATOR:
+        case IMMEDIATE:
+        case RELATIVE:
+        case INDIRECT:
+            return ACCESS_NONE;
+        default:
+            break;
+    }
+    switch (inst->inst_type) {
+        case JMP_OP:
+        case JSR_OP:
+            return ACCESS_NONE;
+        case STA_OP:
+        case STX_OP:
+        case STY_OP:
+            return ACCESS_WRITE;
+        case ASL_OP:
+        case LSR_OP:
+        case ROL_OP:
+        case ROR_OP:
+        case INC_OP:
+        case DEC_OP:
+            return ACCESS_MODIFY;
+        default:
+            return ACCESS_READ;
+    }
+}
+
+// one cpu cycle without a bus access of consequence, other components are caught up to it first
+static void tick(NES *nes) {
+    sync_components(nes);
+    nes->cpu.cycles++;
+}
+
+static uint8_t bus_read(NES *nes, uint16_t addr) {
+    sync_components(nes);
+    uint8_t value = read_mem(nes, addr);
+    nes->cpu.cycles++;
+    return value;
+}
+
+static void bus_write(NES *nes, uint16_t addr, uint8_t value) {
+    sync_components(nes);
+    write_mem(nes, addr, value);
+    nes->cpu.cycles++;
+}
+
+// indexing adds to the low byte first, the cpu reads the unfixed address while carrying into the high byte,
+// reads that crossed no page keep that read as their real access
+static uint16_t index_address(NES *nes, uint16_t base, uint8_t index, ACCESS access) {
+    uint16_t addr = base + index;
+    if (page_crossed(base, addr) || access != ACCESS_READ) {
+        bus_read(nes, (base & 0xff00) | (addr & 0x00ff));
+    }
+    return addr;
+}
+
+// resolves a memory operand after its bytes were fetched, issuing the pointer and dummy reads on their cycles
+static uint16_t operand_address(NES *nes, const Inst *inst, ACCESS access) {
+    uint16_t base = (inst->body[1] << 8) | inst->body[0];
+    uint8_t pointer = inst->body[0];
+    switch (inst->addr_mode) {
+        case ZERO_PAGE_X:
+            bus_read(nes, pointer);
+            return (uint8_t) (pointer + nes->cpu.x_reg);
+        case ZERO_PAGE_Y:
+            bus_read(nes, pointer);
+            return (uint8_t) (pointer + nes->cpu.y_reg);
+        case ABSOLUTE:
+            return base;
+        case ABSOLUTE_X:
+            return index_address(nes, base, nes->cpu.x_reg, access);
+        case ABSOLUTE_Y:
+            return index_address(nes, base, nes->cpu.y_reg, access);
+        case INDIRECT_X:
+            bus_read(nes, pointer);
+            pointer += nes->cpu.x_reg;
+            base = bus_read(nes, pointer);
+            return (bus_read(nes, (uint8_t) (pointer + 1)) << 8) | base;
+        case INDIRECT_Y:
+            base = bus_read(nes, pointer);
+            base |= bus_read(nes, (uint8_t) (pointer + 1)) << 8;
+            return index_address(nes, base, nes->cpu.y_reg, access);
+        default: // zero page
+            return pointer;
+    }
+}
+
+// runs the operation of inst on an already read operand, a write it makes lands on the current cycle
+static void exec_op(NES *nes, const Inst *inst, uint16_t addr, uint8_t value) {
+    Inst op = *inst;
+    op.addr_mode = IMMEDIATE; // operand comes from the body, the address from scratch space
+    op.body[0] = value;
+    nes->cpu.operand_mem_addr = addr;
+
+    uint64_t cycles = nes->cpu.cycles;
+    exec_inst(nes, &op);
+    nes->cpu.cycles = cycles;
+}
+
+// executes an instruction already fetched from the program counter, performing every bus access on the
+// cycle the 6502 does, dummy reads and the unchanged write of read-modify-write included
+unsigned issue_inst_cycles(NES *nes, const Inst *inst) {
+    uint64_t start = nes->cpu.cycles;
+    nes->cpu.program_c += inst->size_bytes;
+    for (unsigned i = 0; i < inst->size_bytes; i++) { // opcode and operand fetches, already decoded
+        tick(nes);
+    }
+
+    ACCESS access = inst_access(inst);
+    uint16_t addr;
+    uint8_t value;
+    switch (access) {
+        case ACCESS_READ:
+            addr = operand_address(nes, inst, access);
+            value = bus_read(nes, addr);
+            exec_op(nes, inst, addr, value);
+            break;
+        case ACCESS_WRITE:
+            addr = operand_address(nes, inst, access);
+            sync_components(nes);
+            exec_op(nes, inst, addr, 0);
+            nes->cpu.cycles++;
+            break;
+        case ACCESS_MODIFY:
+            addr = operand_address(nes, inst, access);
+            value = bus_read(nes, addr);
+            bus_write(nes, addr, value);
+            sync_components(nes);
+            exec_op(nes, inst, addr, value);
+            nes->cpu.cycles++;
+            break;
+        case ACCESS_NONE:
+            if (inst->addr_mode == IMPLIED || inst->addr_mode == ACCUMULATOR) {
+                bus_read(nes, nes->cpu.program_c); // reads the byte after the opcode and ignores it
+            }
+            // the remaining cycles only touch the stack, vectors and program, so effects land at once
+            uint64_t now = nes->cpu.cycles;
+            nes->cpu.cycles = start;
+            unsigned cycles = exec_inst(nes, inst);
+            nes->cpu.cycles = now;
+            while (nes->cpu.cycles < start + cycles) {
+                tick(nes);
+            }
+            break;
+    }
+    return nes->cpu.cycles - start;
+}
+
+// $MAXNES_CYCLE_DB, else $XDG_CONFIG_HOME/maxnes/cycle-stepped falling back to ~/.config
+static FILE *open_cycle_db(void) {
+    const char *path = getenv(CYCLE_DB_ENV);
+    if (path && *path) {
+        return fopen(path, "r");
+    }
+    const char *base = getenv("XDG_CONFIG_HOME");
+    const char *suffix = "";
+    if (!base || !*base) {
+        base = getenv("HOME");
+        suffix = "/.config";
+    }
+    if (!base || !*base) {
+        return NULL;
+    }
+
+    char *db = (char*) malloc(strlen(base) + strlen(suffix) + sizeof("/maxnes/cycle-stepped"));
+    sprintf(db, "%s%s/maxnes/cycle-stepped", base, suffix);
+    FILE *file = fopen(db, "r");
+    free(db);
+    return file;
+}
+
+// whether the rom is listed as depending on sub-instruction bus timing, the database has one rom hash
+// in hex per line optionally followed by a title, lines starting with # are comments
+bool needs_cycle_stepping(const ROM *rom) {
+    FILE *db = open_cycle_db();
+    if (db == NULL) {
+        return false;
+    }
+
+    uint64_t hash = rom_hash(rom);
+    bool listed = false;
+    char line[256];
+    while (!listed && fgets(line, sizeof(line), db)) {
+        char *end;
+        unsigned long long entry = strtoull(line, &end, 16);
+        listed = line[0] != '#' && end != line && entry == hash;
+    }
+    fclose(db);
+    return listed;
+}
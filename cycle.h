@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stdbool.h>
+#include "nes.h"
+
+#define CYCLE_DB_ENV "MAXNES_CYCLE_DB"
+
+unsigned issue_inst_cycles(NES *nes, const Inst *inst);
+bool needs_cycle_stepping(const ROM *rom);
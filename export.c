@@ -0,0 +1,94 @@
+#define _GNU_SOURCE
+#include "export.h"
+#include "nes.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// creates a posix shared memory segment under name, or an anonymous memfd when name is NULL
+Export *new_export(const char *name) {
+    int fd = name ? shm_open(name, O_CREAT | O_RDWR, 0600) : memfd_create("maxnes-export", 0);
+    if (fd < 0) {
+        perror("Error: unable to create export segment");
+        return NULL;
+    }
+    if (ftruncate(fd, sizeof(ExportShared)) < 0) {
+        perror("Error: unable to size export segment");
+        close(fd);
+        return NULL;
+    }
+
+    ExportShared *shared = (ExportShared*) mmap(NULL, sizeof(ExportShared), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (shared == MAP_FAILED) {
+        perror("Error: unable to map export segment");
+        close(fd);
+        return NULL;
+    }
+
+    memset(shared, 0, sizeof(ExportShared));
+    shared->magic = EXPORT_MAGIC;
+    shared->version = EXPORT_VERSION;
+
+    Export *export = (Export*) calloc(1, sizeof(Export));
+    export->fd = fd;
+    export->name = name ? strdup(name) : NULL;
+    export->shared = shared;
+    return export;
+}
+
+void delete_export(Export *export) {
+    munmap(export->shared, sizeof(ExportShared));
+    close(export->fd);
+    if (export->name) {
+        shm_unlink(export->name);
+        free(export->name);
+    }
+    free(export);
+}
+
+// copies the completed frame and ram into the buffer readers are not directed to
+void publish_frame(Export *export, const NES *nes) {
+    uint64_t frame = ++export->published;
+    ExportFrame *buffer = &export->shared->buffers[frame % EXPORT_BUFFERS];
+
+    uint64_t seq = atomic_load_explicit(&buffer->seq, memory_order_relaxed);
+    atomic_store_explicit(&buffer->seq, seq + 1, memory_order_relaxed); // odd, write in progress
+    atomic_thread_fence(memory_order_release);
+
+    buffer->frame = frame;
+    memcpy(buffer->framebuffer, ppu_frame(&nes->ppu), sizeof(buffer->framebuffer));
+    buffer->emphasis = ppu_frame_emphasis(&nes->ppu);
+    memcpy(buffer->ram, nes->ram, sizeof(buffer->ram));
+
+    atomic_store_explicit(&buffer->seq, seq + 2, memory_order_release);
+    atomic_store_explicit(&export->shared->latest, frame, memory_order_release);
+}
+
+// consumer side helper copying the newest consistent frame, returns false if none is published yet
+bool read_exported_frame(const ExportShared *shared, ExportFrame *copy) {
+    for (;;) {
+        uint64_t latest = atomic_load_explicit((_Atomic uint64_t*) &shared->latest, memory_order_acquire);
+        if (!latest) {
+            return false;
+        }
+
+        const ExportFrame *buffer = &shared->buffers[latest % EXPORT_BUFFERS];
+        uint64_t before = atomic_load_explicit((_Atomic uint64_t*) &buffer->seq, memory_order_acquire);
+        if (before & 1) { // writer lapped the reader and is rewriting this buffer
+            continue;
+        }
+
+        copy->frame = buffer->frame;
+        copy->emphasis = buffer->emphasis;
+        memcpy(copy->framebuffer, buffer->framebuffer, sizeof(copy->framebuffer));
+        memcpy(copy->ram, buffer->ram, sizeof(copy->ram));
+
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit((_Atomic uint64_t*) &buffer->seq, memory_order_relaxed) == before) {
+            return true;
+        }
+    }
+}
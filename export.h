@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "ppu.h"
+#include "ram.h"
+
+#define EXPORT_MAGIC 0x50584e4d // "MNXP"
+#define EXPORT_VERSION 2
+#define EXPORT_BUFFERS 2
+
+typedef struct NES NES;
+
+// one completed frame, guarded by its own sequence lock
+// seq is odd while the emulator is writing the buffer and even once it is consistent
+typedef struct ExportFrame {
+    _Atomic uint64_t seq;
+    uint64_t frame;                                     // frame number, counting from 1
+    uint8_t framebuffer[SCREEN_WIDTH * SCREEN_HEIGHT];  // palette indices
+    uint8_t emphasis;                                   // color emphasis bits, see palette_to_rgb
+    uint8_t ram[NES_RAM_SIZE];
+} ExportFrame;
+
+// layout of the shared segment, readable by any process that maps it
+// readers load latest, use buffers[latest % EXPORT_BUFFERS] in place, then check that its seq
+// still matches the even value seen before reading; the emulator never blocks on readers
+typedef struct ExportShared {
+    uint32_t magic;
+    uint32_t version;
+    _Atomic uint64_t latest;                            // frame number of newest complete buffer, 0 if none
+    ExportFrame buffers[EXPORT_BUFFERS];
+} ExportShared;
+
+typedef struct Export {
+    int fd;                 // memfd or shm descriptor, can be passed to consumers
+    char *name;             // shm name, NULL when backed by memfd
+    ExportShared *shared;
+    uint64_t published;
+} Export;
+
+Export *new_export(const char *name);
+void delete_export(Export *export);
+void publish_frame(Export *export, const NES *nes);
+bool read_exported_frame(const ExportShared *shared, ExportFrame *copy);
@@ -0,0 +1,77 @@
+#include "fusion.h"
+#include "nes.h"
+
+// peephole pass over decoded prg tagging instruction pairs that run as one superinstruction
+// entering at the second instruction of a pair executes it alone, since every offset is decoded
+void fuse_insts(ROM *rom) {
+    for (unsigned byte = 0; byte < rom->inst_amount; byte++) {
+        Inst *first = &rom->prg_inst[byte];
+        if (byte + first->size_bytes >= rom->inst_amount) { // pair would wrap around prg
+            continue;
+        }
+        const Inst *second = first + first->size_bytes;
+
+        if (first->inst_type == LDA_OP && first->addr_mode == ZERO_PAGE &&
+                second->inst_type == STA_OP && second->addr_mode == ABSOLUTE) {
+            first->fused = FUSE_LDA_ZP_STA_ABS;
+        } else if (first->inst_type == CMP_OP && first->addr_mode == IMMEDIATE && second->inst_type == BNE_OP) {
+            first->fused = FUSE_CMP_IMM_BNE;
+        } else if (first->inst_type == DEX_OP && second->inst_type == BNE_OP) {
+            first->fused = FUSE_DEX_BNE;
+        } else if (first->inst_type == CLC_OP && second->inst_type == ADC_OP && second->addr_mode == IMMEDIATE) {
+            first->fused = FUSE_CLC_ADC_IMM;
+        } else if (first->inst_type == INC_OP && first->addr_mode == ZERO_PAGE &&
+                second->inst_type == LDA_OP && second->addr_mode == ZERO_PAGE && first->body[0] == second->body[0]) {
+            first->fused = FUSE_INC_ZP_LDA_ZP;
+        }
+    }
+}
+
+// executes a fused pair, program counter points at the first instruction
+// operands are known statically so no operand resolution is needed, and flags that
+// the second instruction overwrites are not computed for the first
+// caller guarantees no event falls between the two instructions
+unsigned exec_fused(NES *nes, const Inst *inst) {
+    CPU *cpu = &nes->cpu;
+    const Inst *second = inst + inst->size_bytes;
+    unsigned cycles = inst->cycles + second->cycles;
+    uint8_t value;
+
+    cpu->program_c += inst->size_bytes + second->size_bytes;
+    cpu->cycles += inst->cycles; // the second instruction's bus accesses are timed after the first, as unfused
+    switch (inst->fused) {
+        case FUSE_LDA_ZP_STA_ABS:
+            value = nes->ram[inst->body[0]];
+            update_cpu_status(nes, cpu->acc_reg = value);
+            write_mem(nes, (second->body[1] << 8) | second->body[0], value);
+            break;
+        case FUSE_CMP_IMM_BNE:
+            cpu->operand_val = inst->body[0];
+            exec_cmp_op(nes, inst);
+            cpu->operand_val = second->body[0];
+            cycles += exec_branch(nes, second, cpu->acc_reg != inst->body[0]);
+            break;
+        case FUSE_DEX_BNE:
+            update_cpu_status(nes, --cpu->x_reg);
+            cpu->operand_val = second->body[0];
+            cycles += exec_branch(nes, second, cpu->x_reg != 0);
+            break;
+        case FUSE_CLC_ADC_IMM:
+            set_cpu_status_bit(cpu, CARRY, 0);
+            cpu->operand_val = second->body[0];
+            exec_adc_op(nes, second);
+            break;
+        case FUSE_INC_ZP_LDA_ZP:
+            value = nes->ram[inst->body[0]] + 1;
+            nes->ram[inst->body[0]] = value;
+            mark_ram_dirty(nes, inst->body[0]);
+            update_cpu_status(nes, cpu->acc_reg = value);
+            break;
+        default:
+            break;
+    }
+
+    cpu->cycles += cycles - inst->cycles;
+    cpu->insts += 2;
+    return cycles;
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include "instruction.h"
+
+typedef struct ROM ROM;
+typedef struct NES NES;
+
+void fuse_insts(ROM *rom);
+unsigned exec_fused(NES *nes, const Inst *inst);
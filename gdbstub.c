@@ -0,0 +1,509 @@
+#include "gdbstub.h"
+#include "nes.h"
+#include "native.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#define GDB_SIGINT 2
+#define GDB_SIGILL 4
+#define GDB_SIGTRAP 5
+
+// registers in g packet order, pc is the only 16-bit one
+static const char target_xml[] =
+    "<?xml version=\"1.0\"?><!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+    "<target version=\"1.0\"><feature name=\"org.maxnes.cpu\">"
+    "<reg name=\"a\" bitsize=\"8\" regnum=\"0\"/>"
+    "<reg name=\"x\" bitsize=\"8\"/>"
+    "<reg name=\"y\" bitsize=\"8\"/>"
+    "<reg name=\"p\" bitsize=\"8\"/>"
+    "<reg name=\"sp\" bitsize=\"8\"/>"
+    "<reg name=\"pc\" bitsize=\"16\" type=\"code_ptr\"/>"
+    "</feature></target>";
+
+// one debugging connection and the console it controls
+typedef struct GDBSession {
+    int fd;
+    ROM *rom;               // private copy, its decoded instructions carry the breakpoint flags
+    NES *nes;
+    uint8_t input[GDB_PACKET_SIZE];
+    size_t input_len;
+    size_t input_pos;
+} GDBSession;
+
+// listens on a loopback tcp port when endpoint is a number, on a unix socket path otherwise,
+// and accepts a single connection
+static int accept_gdb(const char *endpoint) {
+    char *end;
+    long port = strtol(endpoint, &end, 10);
+    bool tcp = *endpoint && !*end;
+    int listener = socket(tcp ? AF_INET : AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        perror("Error: unable to create gdb socket");
+        return -1;
+    }
+
+    int bound;
+    if (tcp) {
+        int on = 1;
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        struct sockaddr_in addr = {0};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((uint16_t) port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bound = bind(listener, (struct sockaddr*) &addr, sizeof(addr));
+    } else {
+        struct sockaddr_un addr = {0};
+        addr.sun_family = AF_UNIX;
+        if (strlen(endpoint) >= sizeof(addr.sun_path)) {
+            fprintf(stderr, "Error: gdb socket path too long\n");
+            close(listener);
+            return -1;
+        }
+        strcpy(addr.sun_path, endpoint);
+        unlink(endpoint);
+        bound = bind(listener, (struct sockaddr*) &addr, sizeof(addr));
+    }
+    if (bound < 0 || listen(listener, 1) < 0) {
+        perror("Error: unable to listen for gdb");
+        close(listener);
+        return -1;
+    }
+
+    printf("waiting for gdb on %s\n", endpoint);
+    fflush(stdout); // scripts launching the stub wait for this line
+    int fd = accept(listener, NULL, NULL);
+    close(listener);
+    if (!tcp) {
+        unlink(endpoint);
+    }
+    if (fd < 0) {
+        perror("Error: unable to accept gdb");
+        return -1;
+    }
+    if (tcp) {
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)); // replies are small and awaited one by one
+    }
+    return fd;
+}
+
+// next byte from gdb, -1 once the connection is closed, or when wait is false and none has arrived yet
+static int read_byte(GDBSession *session, bool wait) {
+    if (session->input_pos == session->input_len) {
+        struct pollfd ready = {session->fd, POLLIN, 0};
+        if (!wait && poll(&ready, 1, 0) <= 0) {
+            return -1;
+        }
+        ssize_t received = recv(session->fd, session->input, sizeof(session->input), 0);
+        if (received <= 0) {
+            return -1;
+        }
+        session->input_len = received;
+        session->input_pos = 0;
+    }
+    return session->input[session->input_pos++];
+}
+
+static int hex_digit(int c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+// parses hex digits at *text, advancing past them
+static unsigned long parse_hex(const char **text) {
+    unsigned long value = 0;
+    for (int digit; (digit = hex_digit(**text)) >= 0; (*text)++) {
+        value = value << 4 | digit;
+    }
+    return value;
+}
+
+// receives the next $packet#checksum into packet, acknowledging it, returns false once gdb disconnects
+static bool read_packet(GDBSession *session, char *packet) {
+    for (;;) {
+        int c;
+        while ((c = read_byte(session, true)) != '$') { // acks and stray interrupts between packets
+            if (c < 0) {
+                return false;
+            }
+        }
+
+        size_t length = 0;
+        uint8_t sum = 0;
+        while ((c = read_byte(session, true)) != '#') {
+            if (c < 0) {
+                return false;
+            }
+            if (length < GDB_PACKET_SIZE) {
+                packet[length++] = c;
+            }
+            sum += c;
+        }
+        packet[length] = '\0';
+
+        int high = hex_digit(read_byte(session, true));
+        int low = hex_digit(read_byte(session, true));
+        bool valid = high >= 0 && low >= 0 && (high << 4 | low) == sum && length < GDB_PACKET_SIZE;
+        if (send(session->fd, valid ? "+" : "-", 1, MSG_NOSIGNAL) != 1) {
+            return false;
+        }
+        if (valid) {
+            return true;
+        }
+    }
+}
+
+// sends reply as a packet, retransmitting until gdb acknowledges it
+static bool send_packet(GDBSession *session, const char *reply) {
+    size_t length = strlen(reply);
+    char *packet = (char*) malloc(length + 5); // $, reply, #, checksum and the terminator sprintf adds
+    uint8_t sum = 0;
+    for (size_t i = 0; i < length; i++) {
+        sum += reply[i];
+    }
+    packet[0] = '$';
+    memcpy(packet + 1, reply, length);
+    sprintf(packet + 1 + length, "#%02x", sum);
+
+    bool sent = false;
+    for (;;) {
+        if (send(session->fd, packet, length + 4, MSG_NOSIGNAL) != (ssize_t) (length + 4)) {
+            break;
+        }
+        int ack = read_byte(session, true);
+        if (ack == '+' || ack < 0) {
+            sent = ack == '+';
+            break;
+        }
+    }
+    free(packet);
+    return sent;
+}
+
+// debugger view of the bus without side effects, registers and unmapped space read as 0
+static uint8_t peek(const NES *nes, uint16_t addr) {
+    const uint8_t *page = direct_page(nes, addr >> 8);
+    return page ? page[addr & 0xff] : 0;
+}
+
+// decoded entry a breakpoint at addr flags, NULL outside rom where instructions are decoded on the fly
+static Inst *breakpoint_entry(GDBSession *session, unsigned long addr) {
+    if (addr < PRG_ROM_START || addr > 0xffff || !session->rom->inst_amount) {
+        return NULL;
+    }
+    return &session->rom->prg_inst[prg_offset(session->rom, addr)];
+}
+
+static uint8_t watched_kinds(const NES *nes, uint16_t addr) {
+    WatchPage *page = nes->watches ? nes->watches->pages[addr >> 8] : NULL;
+    return page ? page->kinds[addr & 0xff] : 0;
+}
+
+// drops recorded accesses, returning the first one through event if there was any
+static bool take_first_access(NES *nes, WatchEvent *event) {
+    WatchEvent discarded[64];
+    uint64_t dropped;
+    bool taken = take_watch_events(nes, event, 1, &dropped);
+    while (take_watch_events(nes, discarded, 64, &dropped)) {
+    }
+    return taken;
+}
+
+// runs until a breakpoint, watchpoint or invalid instruction stops the console or gdb interrupts it,
+// or for a single instruction when step is set, returns the signal to report
+static int resume(GDBSession *session, bool step) {
+    NES *nes = session->nes;
+    WatchEvent event;
+    take_first_access(nes, &event);
+    nes->status = NES_OK;
+
+    Inst *entry = breakpoint_entry(session, nes->cpu.program_c);
+    bool on_breakpoint = entry && entry->fused == FUSE_BREAKPOINT;
+    if (step || on_breakpoint) { // the breakpoint resumed from is lifted for one instruction
+        if (on_breakpoint) {
+            entry->fused = FUSE_NONE;
+        }
+        step_nes(nes);
+        if (on_breakpoint) {
+            entry->fused = FUSE_BREAKPOINT;
+        }
+    }
+
+    while (!step && nes->status == NES_OK) {
+        run_nes(nes, nes->cpu.cycles + GDB_POLL_CYCLES);
+        int c = read_byte(session, false);
+        if (c == 0x03) {
+            return GDB_SIGINT;
+        }
+    }
+    return nes->status == NES_INVALID_INSTRUCTION ? GDB_SIGILL : GDB_SIGTRAP;
+}
+
+// stop reason of a watchpoint, named after the kinds watched at its address: z2 sets writes, z3 reads, z4 both
+static const char *watch_reason(uint8_t kinds) {
+    if ((kinds & WATCH_READ) && (kinds & WATCH_WRITE)) {
+        return "awatch";
+    }
+    return kinds & WATCH_READ ? "rwatch" : "watch";
+}
+
+// stop reply, naming the watched address when an access stopped the console
+static void report_stop(GDBSession *session, int signal, char *reply) {
+    WatchEvent event;
+    if (signal == GDB_SIGTRAP && take_first_access(session->nes, &event)) {
+        uint8_t kinds = watched_kinds(session->nes, event.addr);
+        sprintf(reply, "T%02x%s:%04x;", signal, watch_reason(kinds ? kinds : event.kinds), event.addr);
+    } else {
+        sprintf(reply, "S%02x", signal);
+    }
+}
+
+// Z and z packets: type 0 and 1 are breakpoints, 2 to 4 write, read and access watchpoints
+static void set_point(GDBSession *session, const char *packet, char *reply) {
+    bool insert = packet[0] == 'Z';
+    const char *text = packet + 1;
+    unsigned long type = parse_hex(&text);
+    text += *text == ',';
+    unsigned long addr = parse_hex(&text);
+    text += *text == ',';
+    unsigned long length = parse_hex(&text);
+
+    if (type <= 1) {
+        Inst *entry = breakpoint_entry(session, addr);
+        if (!entry) {
+            strcpy(reply, "E01");
+            return;
+        }
+        entry->fused = insert ? FUSE_BREAKPOINT : FUSE_NONE;
+    } else if (type <= 4 && addr + length <= 0x10000) {
+        uint8_t kinds = type == 2 ? WATCH_WRITE : type == 3 ? WATCH_READ : WATCH_READ | WATCH_WRITE;
+        for (unsigned long i = addr; i < addr + length; i++) {
+            uint8_t current = watched_kinds(session->nes, i);
+            set_watch(session->nes, i, insert ? current | kinds : current & ~kinds);
+        }
+        if (session->nes->watches) {
+            session->nes->watches->halt = true;
+        }
+    } else {
+        reply[0] = '\0'; // unsupported, gdb falls back on its own
+        return;
+    }
+    strcpy(reply, "OK");
+}
+
+static void read_registers(const CPU *cpu, char *reply) {
+    sprintf(reply, "%02x%02x%02x%02x%02x%02x%02x", cpu->acc_reg, cpu->x_reg, cpu->y_reg, cpu->status_reg,
+            cpu->stack_p, cpu->program_c & 0xff, cpu->program_c >> 8);
+}
+
+// sets register number from little-endian hex text, returns false for unknown registers
+static bool write_register(CPU *cpu, unsigned long number, const char *text) {
+    unsigned value = 0;
+    for (unsigned i = 0; i < (number == 5 ? 2 : 1); i++) {
+        int high = hex_digit(text[2 * i]);
+        int low = high >= 0 ? hex_digit(text[2 * i + 1]) : -1;
+        if (low < 0) {
+            return false;
+        }
+        value |= (unsigned) (high << 4 | low) << (8 * i);
+    }
+    switch (number) {
+        case 0: cpu->acc_reg = value; return true;
+        case 1: cpu->x_reg = value; return true;
+        case 2: cpu->y_reg = value; return true;
+        case 3: cpu->status_reg = value; return true;
+        case 4: cpu->stack_p = value; return true;
+        case 5: cpu->program_c = value; return true;
+    }
+    return false;
+}
+
+static void read_memory(const NES *nes, const char *text, char *reply) {
+    unsigned long addr = parse_hex(&text);
+    text += *text == ',';
+    unsigned long length = parse_hex(&text);
+    if (length > GDB_PACKET_SIZE / 2 - 1) {
+        length = GDB_PACKET_SIZE / 2 - 1;
+    }
+    for (unsigned long i = 0; i < length; i++) {
+        sprintf(reply + 2 * i, "%02x", peek(nes, addr + i));
+    }
+    reply[2 * length] = '\0';
+}
+
+// only ram is writable, stores to registers would have side effects and rom is shared with the decoded table
+static void write_memory(NES *nes, const char *text, char *reply) {
+    unsigned long addr = parse_hex(&text);
+    text += *text == ',';
+    unsigned long length = parse_hex(&text);
+    text += *text == ':';
+    if (addr + length > 0x2000 || strlen(text) < 2 * length) {
+        strcpy(reply, "E01");
+        return;
+    }
+    for (unsigned long i = 0; i < 2 * length; i++) { // nothing is stored unless the whole payload is valid
+        if (hex_digit(text[i]) < 0) {
+            strcpy(reply, "E01");
+            return;
+        }
+    }
+    for (unsigned long i = 0; i < length; i++) {
+        unsigned offset = (addr + i) % NES_RAM_SIZE;
+        nes->ram[offset] = hex_digit(text[2 * i]) << 4 | hex_digit(text[2 * i + 1]);
+        mark_ram_dirty(nes, offset);
+    }
+    strcpy(reply, "OK");
+}
+
+// qXfer:features:read:target.xml:offset,length
+static void read_target_xml(const char *text, char *reply) {
+    unsigned long offset = parse_hex(&text);
+    text += *text == ',';
+    unsigned long length = parse_hex(&text);
+    if (length > GDB_PACKET_SIZE - 2) {
+        length = GDB_PACKET_SIZE - 2;
+    }
+    size_t size = sizeof(target_xml) - 1;
+    if (offset >= size) {
+        strcpy(reply, "l");
+        return;
+    }
+    size_t chunk = size - offset < length ? size - offset : length;
+    reply[0] = offset + chunk < size ? 'm' : 'l';
+    memcpy(reply + 1, target_xml + offset, chunk);
+    reply[1 + chunk] = '\0';
+}
+
+static void query(const char *packet, char *reply) {
+    static const char features[] = "qXfer:features:read:target.xml:";
+    if (!strncmp(packet, "qSupported", 10)) {
+        sprintf(reply, "PacketSize=%x;qXfer:features:read+", GDB_PACKET_SIZE);
+    } else if (!strncmp(packet, features, sizeof(features) - 1)) {
+        read_target_xml(packet + sizeof(features) - 1, reply);
+    } else if (!strcmp(packet, "qAttached")) {
+        strcpy(reply, "1");
+    } else if (!strcmp(packet, "qC")) {
+        strcpy(reply, "QC1");
+    } else if (!strcmp(packet, "qfThreadInfo")) {
+        strcpy(reply, "m1");
+    } else if (!strcmp(packet, "qsThreadInfo")) {
+        strcpy(reply, "l");
+    } else {
+        reply[0] = '\0';
+    }
+}
+
+// answers one packet, returns false once gdb detaches or kills the session
+static bool handle_packet(GDBSession *session, const char *packet, char *reply) {
+    CPU *cpu = &session->nes->cpu;
+    const char *text = packet + 1;
+    reply[0] = '\0';
+    switch (packet[0]) {
+        case '?':
+            sprintf(reply, "S%02x", GDB_SIGTRAP);
+            break;
+        case 'g':
+            read_registers(cpu, reply);
+            break;
+        case 'G':
+            for (unsigned i = 0; i < 6; i++) {
+                if (!write_register(cpu, i, text)) {
+                    strcpy(reply, "E01");
+                    return true;
+                }
+                text += i == 5 ? 4 : 2;
+            }
+            strcpy(reply, "OK");
+            break;
+        case 'p': {
+            unsigned long number = parse_hex(&text);
+            if (number > 5) {
+                strcpy(reply, "E01");
+            } else {
+                char registers[16];
+                read_registers(cpu, registers);
+                sprintf(reply, "%.*s", number == 5 ? 4 : 2, registers + 2 * number);
+            }
+            break;
+        }
+        case 'P': {
+            unsigned long number = parse_hex(&text);
+            strcpy(reply, *text == '=' && write_register(cpu, number, text + 1) ? "OK" : "E01");
+            break;
+        }
+        case 'm':
+            read_memory(session->nes, text, reply);
+            break;
+        case 'M':
+            write_memory(session->nes, text, reply);
+            break;
+        case 'c':
+        case 's':
+            if (*text) { // resume address
+                cpu->program_c = parse_hex(&text);
+            }
+            report_stop(session, resume(session, packet[0] == 's'), reply);
+            break;
+        case 'Z':
+        case 'z':
+            set_point(session, packet, reply);
+            break;
+        case 'H':
+        case 'T':
+            strcpy(reply, "OK"); // the console is the one thread
+            break;
+        case 'q':
+            query(packet, reply);
+            break;
+        case 'D':
+        case 'k':
+            strcpy(reply, "OK");
+            return false;
+    }
+    return true;
+}
+
+// serves one gdb remote serial protocol session on a fresh console running rom, endpoint is a loopback tcp
+// port or a unix socket path; the console runs a private copy of the decoded rom with fusion and recompiled
+// blocks off, so flagging its entries as breakpoints costs nothing elsewhere and no instruction is skipped
+bool serve_gdb(const ROM *rom, const char *endpoint) {
+    GDBSession session = {0};
+    session.fd = accept_gdb(endpoint);
+    if (session.fd < 0) {
+        return false;
+    }
+    session.rom = replicate_rom(rom);
+    unload_native(session.rom);
+    for (unsigned i = 0; i < session.rom->inst_amount; i++) {
+        session.rom->prg_inst[i].fused = FUSE_NONE;
+    }
+    session.nes = new_NES(session.rom);
+
+    static char packet[GDB_PACKET_SIZE + 1];
+    static char reply[GDB_PACKET_SIZE + 1];
+    bool attached = true;
+    while (attached && read_packet(&session, packet)) {
+        attached = handle_packet(&session, packet, reply);
+        if (!send_packet(&session, reply)) {
+            break;
+        }
+    }
+
+    delete_nes(session.nes);
+    close_rom(session.rom);
+    close(session.fd);
+    return true;
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <stdbool.h>
+
+#define GDB_PACKET_SIZE 4096    // longest packet exchanged, announced to gdb
+#define GDB_POLL_CYCLES 29781   // cpu cycles run between checks for an interrupt from gdb, about a frame
+
+typedef struct ROM ROM;
+
+bool serve_gdb(const ROM *rom, const char *endpoint);
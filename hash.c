@@ -0,0 +1,108 @@
+#include "hash.h"
+#include "nes.h"
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define PRIME32_1 0x9e3779b1u
+#define PRIME64_1 0x9e3779b185ebca87ull
+#define PRIME64_2 0xc2b2ae3d27d4eb4full
+#define PRIME64_3 0x165667b19e3779f9ull
+
+#define HASH_LANES 8
+#define STRIPE_BYTES (HASH_LANES * 8)
+#define STRIPES_PER_BLOCK 16
+
+static const uint64_t secret[HASH_LANES] = {
+    0xbe4ba423396cfeb8ull, 0x1cad21f72c81017cull, 0xdb979083e96dd4deull, 0x1f67b3b7a4a44072ull,
+    0x78e5c0cc4ee679cbull, 0x2172ffcc7dd05a82ull, 0x8e2443f7744608b8ull, 0x4c263a81e69035e0ull
+};
+
+// xxh3-style accumulation: every lane adds its neighbor's input word and a 32x32 product of its keyed word,
+// which maps directly onto sse2 64-bit adds and unsigned 32-bit multiplies
+static void accumulate_stripe(uint64_t *acc, const uint8_t *stripe) {
+#ifdef __SSE2__
+    for (unsigned i = 0; i < HASH_LANES; i += 2) {
+        __m128i data = _mm_loadu_si128((const __m128i*) (stripe + i * 8));
+        __m128i keyed = _mm_xor_si128(data, _mm_loadu_si128((const __m128i*) &secret[i]));
+        __m128i product = _mm_mul_epu32(keyed, _mm_srli_epi64(keyed, 32));
+        __m128i swapped = _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+        __m128i sum = _mm_add_epi64(_mm_loadu_si128((const __m128i*) &acc[i]), _mm_add_epi64(product, swapped));
+        _mm_storeu_si128((__m128i*) &acc[i], sum);
+    }
+#else
+    uint64_t data[HASH_LANES];
+    memcpy(data, stripe, sizeof(data));
+    for (unsigned i = 0; i < HASH_LANES; i++) {
+        uint64_t keyed = data[i] ^ secret[i];
+        acc[i] += data[i ^ 1] + (keyed & 0xffffffff) * (keyed >> 32);
+    }
+#endif
+}
+
+// keeps high accumulator bits flowing back down between blocks
+static void scramble(uint64_t *acc) {
+    for (unsigned i = 0; i < HASH_LANES; i++) {
+        acc[i] = (acc[i] ^ (acc[i] >> 47) ^ secret[i]) * PRIME32_1;
+    }
+}
+
+static uint64_t avalanche(uint64_t h) {
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    return h ^ (h >> 32);
+}
+
+// fast non-cryptographic hash, identical with and without sse2
+uint64_t hash64(const void *data, size_t len, uint64_t seed) {
+    const uint8_t *bytes = (const uint8_t*) data;
+    uint64_t acc[HASH_LANES];
+    for (unsigned i = 0; i < HASH_LANES; i++) {
+        acc[i] = seed + secret[i];
+    }
+
+    size_t stripes = len / STRIPE_BYTES;
+    for (size_t s = 0; s < stripes; s++) {
+        accumulate_stripe(acc, bytes + s * STRIPE_BYTES);
+        if (s % STRIPES_PER_BLOCK == STRIPES_PER_BLOCK - 1) {
+            scramble(acc);
+        }
+    }
+    if (len % STRIPE_BYTES) { // zero padded tail, the length is mixed in below
+        uint8_t tail[STRIPE_BYTES] = {0};
+        memcpy(tail, bytes + stripes * STRIPE_BYTES, len % STRIPE_BYTES);
+        accumulate_stripe(acc, tail);
+    }
+
+    uint64_t h = len * PRIME64_1 ^ seed;
+    for (unsigned i = 0; i < HASH_LANES; i++) {
+        h = (h ^ avalanche(acc[i])) * PRIME64_1 + PRIME64_3;
+    }
+    return avalanche(h);
+}
+
+void hash_frame(const NES *nes, FrameHash *hash) {
+    const CPU *cpu = &nes->cpu;
+    uint8_t regs[] = { // packed so struct padding never reaches the hash
+        cpu->acc_reg, cpu->x_reg, cpu->y_reg, cpu->status_reg, cpu->stack_p,
+        cpu->program_c & 0xff, cpu->program_c >> 8
+    };
+    // emphasis seeds the picture hash, the same pixels under other emphasis bits look different
+    hash->framebuffer = hash64(ppu_frame(&nes->ppu), SCREEN_WIDTH * SCREEN_HEIGHT, ppu_frame_emphasis(&nes->ppu));
+    hash->ram = hash64(nes->ram, NES_RAM_SIZE, 0);
+    hash->cpu = hash64(regs, sizeof(regs), cpu->cycles);
+}
+
+bool write_hash_log_header(FILE *file) {
+    HashLogHeader header = {HASH_LOG_MAGIC, HASH_LOG_VERSION};
+    return fwrite(&header, sizeof(header), 1, file) == 1;
+}
+
+bool read_hash_log_header(FILE *file) {
+    HashLogHeader header;
+    return fread(&header, sizeof(header), 1, file) == 1 &&
+        header.magic == HASH_LOG_MAGIC && header.version == HASH_LOG_VERSION;
+}
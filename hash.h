@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#define HASH_LOG_MAGIC 0x48584e4d // "MNXH"
+#define HASH_LOG_VERSION 2
+
+typedef struct NES NES;
+
+// hashes of the observable state after one frame
+typedef struct FrameHash {
+    uint64_t framebuffer;
+    uint64_t ram;
+    uint64_t cpu;
+} FrameHash;
+
+// hash log file: this header followed by one FrameHash per frame, frame numbers are implicit
+typedef struct HashLogHeader {
+    uint32_t magic;
+    uint32_t version;
+} HashLogHeader;
+
+uint64_t hash64(const void *data, size_t len, uint64_t seed);
+void hash_frame(const NES *nes, FrameHash *hash);
+bool write_hash_log_header(FILE *file);
+bool read_hash_log_header(FILE *file);
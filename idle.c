@@ -0,0 +1,104 @@
+#include "idle.h"
+#include "nes.h"
+
+// whether reads from addr can only change through scheduled events
+static bool idle_safe_addr(uint16_t addr) {
+    return addr <= 0x1fff ||            // ram is only written by the cpu itself or dma
+        (addr <= 0x3fff && addr % 8 == 2) || // ppu status, changes at vblank events and reading it is idempotent
+        addr >= PRG_ROM_START;
+}
+
+// whether reading through inst's addressing mode only touches idle-safe memory
+static bool idle_safe_operand(const Inst *inst) {
+    uint16_t addr = (inst->body[1] << 8) | inst->body[0];
+    switch (inst->addr_mode) {
+        case IMPLIED:
+        case IMMEDIATE:
+        case RELATIVE:
+        case ZERO_PAGE:
+        case ZERO_PAGE_X:
+        case ZERO_PAGE_Y:
+            return true;
+        case ABSOLUTE:
+            return idle_safe_addr(addr);
+        case ABSOLUTE_X:
+        case ABSOLUTE_Y: // any index keeps the whole range in ram or rom
+            return addr + 0xff <= 0x1fff || addr >= PRG_ROM_START;
+        default:
+            return false;
+    }
+}
+
+// a loop body qualifies when every instruction only writes registers and flags from
+// memory in an idempotent way, so after one iteration its state is a fixed point
+static bool loop_is_idle(NES *nes, uint16_t head, uint16_t tail) {
+    Inst scratch;
+    uint16_t pc = head;
+    for (unsigned i = 0; i < IDLE_LOOP_MAX_INSTS; i++) {
+        const Inst *inst = fetch_inst(nes, pc, &scratch);
+        if (!idle_safe_operand(inst)) {
+            return false;
+        }
+
+        switch (inst->inst_type) {
+            case LDA_OP: case LDX_OP: case LDY_OP:
+            case AND_OP: case ORA_OP: case BIT_OP:
+            case CMP_OP: case CPX_OP: case CPY_OP:
+            case BCC_OP: case BCS_OP: case BEQ_OP: case BMI_OP:
+            case BNE_OP: case BPL_OP: case BVC_OP: case BVS_OP:
+            case NOP:
+                break;
+            case JMP_OP:
+                if (inst->addr_mode != ABSOLUTE || pc != tail) { // only as the closing jump
+                    return false;
+                }
+                break;
+            default:
+                return false;
+        }
+
+        if (pc == tail) {
+            return true;
+        }
+        pc += inst->size_bytes;
+        if (pc > tail) { // decoded past the jump, body is not a straight instruction sequence
+            return false;
+        }
+    }
+    return false;
+}
+
+// called after a backward jump from jump_pc, skips whole iterations of a provably idle loop
+// up to the end of the current batch, which is the next scheduled event
+void fast_forward_idle_loop(NES *nes, uint16_t jump_pc) {
+    IdleLoop *idle = &nes->idle;
+    uint16_t head = nes->cpu.program_c;
+    uint64_t now = nes->cpu.cycles;
+
+    if (!idle->tracking || idle->head != head) { // first arrival, iteration length unknown
+        idle->tracking = true;
+        idle->head = head;
+        idle->head_cycle = now;
+        return;
+    }
+
+    uint64_t iteration = now - idle->head_cycle;
+    idle->head_cycle = now;
+    if (head < PRG_ROM_START || iteration == 0) {
+        return;
+    }
+
+    if (!idle->analyzed || idle->analyzed_head != head || idle->analyzed_tail != jump_pc) {
+        idle->analyzed = true;
+        idle->analyzed_head = head;
+        idle->analyzed_tail = jump_pc;
+        idle->idle = loop_is_idle(nes, head, jump_pc);
+    }
+
+    if (idle->idle && nes->batch_end > now && !(nes->watches && nes->watches->read_watches)) { // skipped reads are not seen
+        uint64_t skip = (nes->batch_end - now) / iteration * iteration;
+        nes->cpu.cycles += skip;
+        idle->head_cycle += skip;
+        idle->skipped += skip;
+    }
+}
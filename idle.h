@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define IDLE_LOOP_MAX_INSTS 16
+
+typedef struct NES NES;
+
+// tracks candidate busy-wait loop, a loop is only fast-forwarded after a full iteration
+// completes with no event or interrupt in between
+typedef struct IdleLoop {
+    bool tracking;          // head_cycle is valid for head
+    uint16_t head;          // target of last backward jump
+    uint64_t head_cycle;    // cycle count at last arrival at head
+    bool analyzed;          // cached analysis result is valid for head and tail
+    uint16_t analyzed_head;
+    uint16_t analyzed_tail;
+    bool idle;              // loop between head and tail has no side effects
+    uint64_t skipped;       // total cycles fast-forwarded
+} IdleLoop;
+
+void fast_forward_idle_loop(NES *nes, uint16_t jump_pc);
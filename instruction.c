@@ -1,5 +1,8 @@
 #include "instruction.h"
+#include "nes.h"
+#include "fusion.h"
 #include <stdlib.h>
+#include <string.h>
 
 const char* inst_names[] = {
         "NOP",        "ADC",        "AND",        "ASL",
@@ -18,446 +21,463 @@ const char* inst_names[] = {
         "TSX",        "TXA",        "TXS",        "TYA"
 };
 
+// decodes an instruction starting at every prg byte, so any program counter in rom maps directly
+// onto prg_inst[prg_offset(rom, pc)] no matter where the code/data boundaries lie
 void parse_insts(ROM *rom) {
-     rom->prg_inst = (Inst*) calloc(rom->prg_len, sizeof(Inst)); // liberal estimate that each instruction is single byte
+    rom->prg_inst = (Inst*) calloc(rom->prg_len, sizeof(Inst));
 
-    unsigned inst_amount = 0;
-
-    unsigned byte = 0;
-    while (byte < rom->prg_len) {
-        Inst *current = &rom->prg_inst[inst_amount];
+    for (unsigned byte = 0; byte < rom->prg_len; byte++) {
+        Inst *current = &rom->prg_inst[byte];
         classify_inst(rom->prg[byte], current);
-        current->body = (uint8_t*) calloc(current->size_bytes - 1, sizeof(uint8_t)); // create array to store body
         for (unsigned i = 0 ; i < current->size_bytes - 1; i++) {
-            current->body[i] = rom->prg[++byte]; // add adjacent bytes to opcode to body of instruction
+            current->body[i] = rom->prg[(byte + 1 + i) % rom->prg_len]; // add adjacent bytes to opcode to body of instruction
         }
-        byte++;
-        inst_amount++;
     }
 
-    rom->inst_amount = inst_amount;
-    rom->prg_inst = (Inst*) realloc(rom->prg_inst, inst_amount * sizeof(Inst)); // reallocate array to minimum necessary size
+    rom->inst_amount = rom->prg_len;
+    fuse_insts(rom);
+}
+
+// returns decoded instruction at addr, decoding into scratch when executing outside rom
+const Inst *fetch_inst(NES *nes, uint16_t addr, Inst *scratch) {
+    if (addr >= PRG_ROM_START && nes->rom->inst_amount) {
+        return &nes->rom->prg_inst[prg_offset(nes->rom, addr)];
+    }
+
+    memset(scratch, 0, sizeof(Inst));
+    classify_inst(read_mem(nes, addr), scratch);
+    for (unsigned i = 0 ; i < scratch->size_bytes - 1; i++) {
+        scratch->body[i] = read_mem(nes, addr + 1 + i);
+    }
+    return scratch;
+}
+
+// whether instruction reads the memory its operand addresses, stores and jumps only use the address
+static bool reads_operand(const Inst *inst) {
+    switch (inst->inst_type) {
+        case STA_OP:
+        case STX_OP:
+        case STY_OP:
+        case JMP_OP:
+        case JSR_OP:
+            return false;
+        default:
+            return true;
+    }
 }
 
-void update_inst_operand(NES *nes, Inst *inst) {
+// resolves operand of instruction into cpu scratch space, returns whether indexing crossed a page boundary
+bool update_inst_operand(NES *nes, const Inst *inst) {
+    uint16_t base;
     uint16_t addr;
+    bool crossed = false;
     switch(inst->addr_mode) {
         case IMPLIED:
             // no operand storing necessary
-            break;
+            return false;
         case ACCUMULATOR:
-            inst->operand_val = nes->cpu->acc_reg;
-            break;
+            nes->cpu.operand_val = nes->cpu.acc_reg;
+            return false;
         case IMMEDIATE:
-            inst->operand_val = (uint16_t) inst->body[0];
-            break;
+        case RELATIVE:
+            nes->cpu.operand_val = (uint16_t) inst->body[0];
+            return false;
         case ZERO_PAGE:
-            inst->operand_val = *access_ram(nes->ram, inst->body[0]);
-            inst->operand_mem_addr = inst->body[0];
+            addr = inst->body[0];
             break;
-        case  ZERO_PAGE_X:
-            addr = (inst->body[0] + nes->cpu->x_reg) % ZERO_PAGE_SIZE;
-            if (!page_crossed(inst->body[0], addr)) { // page boundary not crossed, no need for extra cycles
-                inst->page_cross_cycles = 0;
-            }
-            inst->operand_val = *access_ram(nes->ram, addr);
-            inst->operand_mem_addr = addr;
+        case  ZERO_PAGE_X: // indexing wraps within zero page, so page is never crossed
+            addr = (inst->body[0] + nes->cpu.x_reg) % ZERO_PAGE_SIZE;
             break;
         case ZERO_PAGE_Y:
-            addr = (inst->body[0] + nes->cpu->y_reg) % ZERO_PAGE_SIZE;
-            if (!page_crossed(inst->body[0], addr)) { // page boundary not crossed, no need for extra cycles
-                inst->page_cross_cycles = 0;
-            }
-            inst->operand_val = *access_ram(nes->ram, addr);
-            inst->operand_mem_addr = addr;
-            break;
-        case RELATIVE:
-            inst->operand_val = inst->body[0];
+            addr = (inst->body[0] + nes->cpu.y_reg) % ZERO_PAGE_SIZE;
             break;
         case ABSOLUTE:
             addr = (inst->body[1] << 8) | inst->body[0];
-            inst->operand_val = *access_ram(nes->ram, addr);
-            inst->operand_mem_addr = addr;
             break;
         case ABSOLUTE_X:
-            addr = ((inst->body[1] << 8) | inst->body[0]) + nes->cpu->x_reg;
-            inst->operand_val = *access_ram(nes->ram, addr);
-            inst->operand_mem_addr = addr;
+            base = (inst->body[1] << 8) | inst->body[0];
+            addr = base + nes->cpu.x_reg;
+            crossed = page_crossed(base, addr);
             break;
         case ABSOLUTE_Y:
-            addr = ((inst->body[1] << 8) | inst->body[0]) + nes->cpu->y_reg;
-            inst->operand_val = *access_ram(nes->ram, addr);
-            inst->operand_mem_addr = addr;
+            base = (inst->body[1] << 8) | inst->body[0];
+            addr = base + nes->cpu.y_reg;
+            crossed = page_crossed(base, addr);
             break;
-        case INDIRECT:
+        case INDIRECT: // only used by jmp, operand is the pointer itself
             addr = (inst->body[1] << 8) | inst->body[0];
-            inst->operand_val = (*access_ram(nes->ram, addr + 1) << 8) | *access_ram(nes->ram, addr);
-            inst->operand_mem_addr = addr;
-            break;
-        case INDIRECT_X:
-            addr = inst->body[0] + nes->cpu->x_reg;
-            inst->operand_val = (*access_ram(nes->ram, addr + 1) << 8) | *access_ram(nes->ram, addr);
-            inst->operand_mem_addr = addr;
-            break;
-        case INDIRECT_Y:
-            addr = *access_ram(nes->ram, inst->body[0]) + nes->cpu->y_reg;
-            if (!page_crossed(inst->body[0], addr)) { // page boundary not crossed, no need for extra cycles
-                inst->page_cross_cycles = 0;
-            }
-            inst->operand_val = *access_ram(nes->ram, addr);
-            inst->operand_mem_addr = addr;
-        default:
-            delete_nes(nes);
-            fprintf(stderr, "Instruction uses invalid memory addressing mode\n");
-            exit(-1);
+            nes->cpu.operand_val = read_mem16(nes, addr);
+            nes->cpu.operand_mem_addr = addr;
+            return false;
+        case INDIRECT_X: // pointer is read from zero page, wrapping within it
+            base = (inst->body[0] + nes->cpu.x_reg) % ZERO_PAGE_SIZE;
+            addr = (read_mem(nes, (base + 1) % ZERO_PAGE_SIZE) << 8) | read_mem(nes, base);
+            break;
+        case INDIRECT_Y: // page crossing is measured between pointer and indexed pointer
+            base = (read_mem(nes, (inst->body[0] + 1) % ZERO_PAGE_SIZE) << 8) | read_mem(nes, inst->body[0]);
+            addr = base + nes->cpu.y_reg;
+            crossed = page_crossed(base, addr);
             break;
+        default:
+            halt_nes(nes, NES_INVALID_INSTRUCTION);
+            return false;
     }
+
+    nes->cpu.operand_mem_addr = addr;
+    if (reads_operand(inst)) {
+        nes->cpu.operand_val = read_mem(nes, addr);
+    }
+    return crossed;
 }
 
-// generalized branch instruction
-inline void exec_branch(NES *nes, Inst *inst, bool condition) {
-    uint16_t old_program_c = nes->cpu->program_c;
-    if (condition) { // follow branch
-        nes->cpu->program_c += inst->operand_val;
-    } else {
-        inst->branch_succeeds_cycles = 0;
+// generalized branch instruction, returns cycles added by taking the branch
+// program counter is expected to already point past the branch instruction
+inline unsigned exec_branch(NES *nes, const Inst *inst, bool condition) {
+    if (!condition) {
+        return 0;
     }
 
-    if (!page_crossed(old_program_c, nes->cpu->program_c)) {
-        inst->page_cross_cycles = 0;
+    uint16_t old_program_c = nes->cpu.program_c;
+    nes->cpu.program_c += (int8_t) nes->cpu.operand_val; // relative distance is signed
+
+    unsigned cycles = inst->branch_succeeds_cycles;
+    if (page_crossed(old_program_c, nes->cpu.program_c)) {
+        cycles += inst->page_cross_cycles;
     }
+    return cycles;
 }
 
 // common case of updating zero and negative flags 
 inline void update_cpu_status(NES *nes, uint8_t value) {
-    set_cpu_status_bit(nes->cpu, ZERO, !value);
-    set_cpu_status_bit(nes->cpu, NEGATIVE, get_bit(value, 7));
+    set_cpu_status_bit(&nes->cpu, ZERO, !value);
+    set_cpu_status_bit(&nes->cpu, NEGATIVE, get_bit(value, 7));
 }
 
 // individual instruction execution functions
 
-void exec_adc_op(NES *nes, Inst *inst) {
-    uint8_t sum = nes->cpu->acc_reg + inst->operand_val + get_cpu_status_bit(nes->cpu, CARRY); // signed, higher-precision value to check for overflow, carry
-    set_cpu_status_bit(nes->cpu, OVERFLOW, 
-            (nes->cpu->acc_reg ^ sum) & (inst->operand_val ^ sum) & 0x80); // overflow formula courtesy of http://www.righto.com/2012/12/the-6502-overflow-flag-explained.html
-    nes->cpu->acc_reg = sum;
-    set_cpu_status_bit(nes->cpu, CARRY, sum > 255);
-    set_cpu_status_bit(nes->cpu, ZERO, !sum);
-    set_cpu_status_bit(nes->cpu, NEGATIVE, get_bit(sum, 7));
+void exec_adc_op(NES *nes, const Inst *inst) {
+    uint8_t sum = nes->cpu.acc_reg + nes->cpu.operand_val + get_cpu_status_bit(&nes->cpu, CARRY); // signed, higher-precision value to check for overflow, carry
+    set_cpu_status_bit(&nes->cpu, OVERFLOW, 
+            (nes->cpu.acc_reg ^ sum) & (nes->cpu.operand_val ^ sum) & 0x80); // overflow formula courtesy of http://www.righto.com/2012/12/the-6502-overflow-flag-explained.html
+    nes->cpu.acc_reg = sum;
+    set_cpu_status_bit(&nes->cpu, CARRY, sum > 255);
+    set_cpu_status_bit(&nes->cpu, ZERO, !sum);
+    set_cpu_status_bit(&nes->cpu, NEGATIVE, get_bit(sum, 7));
 }
 
-void exec_and_op(NES *nes, Inst *inst) {
-    nes->cpu->acc_reg &= inst->operand_val;
-    update_cpu_status(nes, nes->cpu->acc_reg);
+void exec_and_op(NES *nes, const Inst *inst) {
+    nes->cpu.acc_reg &= nes->cpu.operand_val;
+    update_cpu_status(nes, nes->cpu.acc_reg);
 }
 
-void exec_asl_op(NES *nes, Inst *inst) {
-    inst->page_cross_cycles = 0; // resolve difference in absolute x addressing mode cycles
-
+void exec_asl_op(NES *nes, const Inst *inst) {
     uint8_t operand;
     if (inst->addr_mode == ACCUMULATOR) {
-        set_cpu_status_bit(nes->cpu, CARRY, get_bit(nes->cpu->acc_reg, 7)); // most significant bit moved to carry
-        operand = (nes->cpu->acc_reg <<= 1);
+        set_cpu_status_bit(&nes->cpu, CARRY, get_bit(nes->cpu.acc_reg, 7)); // most significant bit moved to carry
+        operand = (nes->cpu.acc_reg <<= 1);
     } else { // shift memory contents
-        set_cpu_status_bit(nes->cpu, CARRY, get_bit(*access_ram(nes->ram, inst->operand_mem_addr), 7)); // most significant bit moved to carry
-        operand = (*access_ram(nes->ram, inst->operand_mem_addr) <<= 1);
+        set_cpu_status_bit(&nes->cpu, CARRY, get_bit(nes->cpu.operand_val, 7)); // most significant bit moved to carry
+        operand = nes->cpu.operand_val << 1;
+        write_mem(nes, nes->cpu.operand_mem_addr, operand);
     }
-    set_cpu_status_bit(nes->cpu, ZERO, !operand);
-    set_cpu_status_bit(nes->cpu, NEGATIVE, get_bit(operand, 7));
+    set_cpu_status_bit(&nes->cpu, ZERO, !operand);
+    set_cpu_status_bit(&nes->cpu, NEGATIVE, get_bit(operand, 7));
 }
 
-void exec_bcc_op(NES *nes, Inst *inst) {
-    exec_branch(nes, inst, !get_cpu_status_bit(nes->cpu, CARRY));
+unsigned exec_bcc_op(NES *nes, const Inst *inst) {
+    return exec_branch(nes, inst, !get_cpu_status_bit(&nes->cpu, CARRY));
 }
 
-void exec_bcs_op(NES *nes, Inst *inst) {
-    exec_branch(nes, inst, get_cpu_status_bit(nes->cpu, CARRY));
+unsigned exec_bcs_op(NES *nes, const Inst *inst) {
+    return exec_branch(nes, inst, get_cpu_status_bit(&nes->cpu, CARRY));
 }
 
-void exec_beq_op(NES *nes, Inst *inst) {
-    exec_branch(nes, inst, get_cpu_status_bit(nes->cpu, ZERO));
+unsigned exec_beq_op(NES *nes, const Inst *inst) {
+    return exec_branch(nes, inst, get_cpu_status_bit(&nes->cpu, ZERO));
 }
 
-void exec_bit_op(NES *nes, Inst *inst) {
-    uint8_t result = nes->cpu->acc_reg & inst->operand_val;
-    set_cpu_status_bit(nes->cpu, ZERO, result);
-    set_cpu_status_bit(nes->cpu, OVERFLOW, get_bit(result, 6));
-    set_cpu_status_bit(nes->cpu, NEGATIVE, get_bit(result, 7));
+void exec_bit_op(NES *nes, const Inst *inst) {
+    uint8_t result = nes->cpu.acc_reg & nes->cpu.operand_val;
+    set_cpu_status_bit(&nes->cpu, ZERO, result);
+    set_cpu_status_bit(&nes->cpu, OVERFLOW, get_bit(result, 6));
+    set_cpu_status_bit(&nes->cpu, NEGATIVE, get_bit(result, 7));
 }
 
-void exec_bmi_op(NES *nes, Inst *inst) {
-    exec_branch(nes, inst, get_cpu_status_bit(nes->cpu, NEGATIVE));
+unsigned exec_bmi_op(NES *nes, const Inst *inst) {
+    return exec_branch(nes, inst, get_cpu_status_bit(&nes->cpu, NEGATIVE));
 }
 
-void exec_bne_op(NES *nes, Inst *inst) {
-    exec_branch(nes, inst, !get_cpu_status_bit(nes->cpu, ZERO));
+unsigned exec_bne_op(NES *nes, const Inst *inst) {
+    return exec_branch(nes, inst, !get_cpu_status_bit(&nes->cpu, ZERO));
 }
 
-void exec_bpl_op(NES *nes, Inst *inst) {
-    exec_branch(nes, inst, !get_cpu_status_bit(nes->cpu, NEGATIVE));
+unsigned exec_bpl_op(NES *nes, const Inst *inst) {
+    return exec_branch(nes, inst, !get_cpu_status_bit(&nes->cpu, NEGATIVE));
 }
 
 void exec_brk_op(NES *nes) { // force interrupt
-    stack_push16(nes, nes->cpu->program_c);
-    stack_push(nes, nes->cpu->status_reg);
-    nes->cpu->program_c = 0xfffe;
-    set_cpu_status_bit(nes->cpu, BRK, 1);
+    stack_push16(nes, nes->cpu.program_c + 1); // skip padding byte following opcode
+    stack_push(nes, nes->cpu.status_reg | (1 << BRK) | (1 << UNUSED));
+    set_cpu_status_bit(&nes->cpu, IRQ_DISABLE, 1);
+    nes->cpu.program_c = read_mem16(nes, IRQ_VECTOR);
 }
 
-void exec_bvc_op(NES *nes, Inst *inst) {
-    exec_branch(nes, inst, !get_cpu_status_bit(nes->cpu, OVERFLOW));
+unsigned exec_bvc_op(NES *nes, const Inst *inst) {
+    return exec_branch(nes, inst, !get_cpu_status_bit(&nes->cpu, OVERFLOW));
 }
 
-void exec_bvs_op(NES *nes, Inst *inst) {
-    exec_branch(nes, inst, get_cpu_status_bit(nes->cpu, OVERFLOW));
+unsigned exec_bvs_op(NES *nes, const Inst *inst) {
+    return exec_branch(nes, inst, get_cpu_status_bit(&nes->cpu, OVERFLOW));
 }
 
 void exec_clc_op(NES *nes) {
-    set_cpu_status_bit(nes->cpu, CARRY, 0);
+    set_cpu_status_bit(&nes->cpu, CARRY, 0);
 }
 
 void exec_cld_op(NES *nes) {
-    set_cpu_status_bit(nes->cpu, DECIMAL, 0);
+    set_cpu_status_bit(&nes->cpu, DECIMAL, 0);
 }
 
 void exec_cli_op(NES *nes) {
-    set_cpu_status_bit(nes->cpu, IRQ_DISABLE, 0);
+    set_cpu_status_bit(&nes->cpu, IRQ_DISABLE, 0);
 }
 
 void exec_clv_op(NES *nes) {
-    set_cpu_status_bit(nes->cpu, OVERFLOW, 0);
+    set_cpu_status_bit(&nes->cpu, OVERFLOW, 0);
 }
 
-void exec_cmp_op(NES *nes, Inst *inst) {
-    uint8_t result = nes->cpu->acc_reg - inst->operand_val;
-    set_cpu_status_bit(nes->cpu, CARRY, nes->cpu->acc_reg >= inst->operand_val);
-    set_cpu_status_bit(nes->cpu, ZERO, nes->cpu->acc_reg == inst->operand_val);
-    set_cpu_status_bit(nes->cpu, NEGATIVE, get_bit(result, 7));
+void exec_cmp_op(NES *nes, const Inst *inst) {
+    uint8_t result = nes->cpu.acc_reg - nes->cpu.operand_val;
+    set_cpu_status_bit(&nes->cpu, CARRY, nes->cpu.acc_reg >= nes->cpu.operand_val);
+    set_cpu_status_bit(&nes->cpu, ZERO, nes->cpu.acc_reg == nes->cpu.operand_val);
+    set_cpu_status_bit(&nes->cpu, NEGATIVE, get_bit(result, 7));
 }
 
-void exec_cpx_op(NES *nes, Inst *inst) {
-    uint8_t result = nes->cpu->x_reg - inst->operand_val;
-    set_cpu_status_bit(nes->cpu, CARRY, nes->cpu->x_reg >= inst->operand_val);
-    set_cpu_status_bit(nes->cpu, ZERO, nes->cpu->x_reg == inst->operand_val);
-    set_cpu_status_bit(nes->cpu, NEGATIVE, get_bit(result, 7));
+void exec_cpx_op(NES *nes, const Inst *inst) {
+    uint8_t result = nes->cpu.x_reg - nes->cpu.operand_val;
+    set_cpu_status_bit(&nes->cpu, CARRY, nes->cpu.x_reg >= nes->cpu.operand_val);
+    set_cpu_status_bit(&nes->cpu, ZERO, nes->cpu.x_reg == nes->cpu.operand_val);
+    set_cpu_status_bit(&nes->cpu, NEGATIVE, get_bit(result, 7));
 }
 
-void exec_cpy_op(NES *nes, Inst *inst) {
-    uint8_t result = nes->cpu->y_reg - inst->operand_val;
-    set_cpu_status_bit(nes->cpu, CARRY, nes->cpu->y_reg >= inst->operand_val);
-    set_cpu_status_bit(nes->cpu, ZERO, nes->cpu->y_reg == inst->operand_val);
-    set_cpu_status_bit(nes->cpu, NEGATIVE, get_bit(result, 7));
+void exec_cpy_op(NES *nes, const Inst *inst) {
+    uint8_t result = nes->cpu.y_reg - nes->cpu.operand_val;
+    set_cpu_status_bit(&nes->cpu, CARRY, nes->cpu.y_reg >= nes->cpu.operand_val);
+    set_cpu_status_bit(&nes->cpu, ZERO, nes->cpu.y_reg == nes->cpu.operand_val);
+    set_cpu_status_bit(&nes->cpu, NEGATIVE, get_bit(result, 7));
 }
 
-void exec_dec_op(NES *nes, Inst *inst) {
-    inst->page_cross_cycles = 0; // resolve difference in absolute x addressing mode cycles
-    update_cpu_status(nes, --(*access_ram(nes->ram, inst->operand_mem_addr)));
+void exec_dec_op(NES *nes, const Inst *inst) {
+    uint8_t result = nes->cpu.operand_val - 1;
+    write_mem(nes, nes->cpu.operand_mem_addr, result);
+    update_cpu_status(nes, result);
 }
 
 void exec_dex_op(NES *nes) {
-    update_cpu_status(nes, --nes->cpu->x_reg);
+    update_cpu_status(nes, --nes->cpu.x_reg);
 }
 
 void exec_dey_op(NES *nes) {
-    update_cpu_status(nes, --nes->cpu->y_reg);
+    update_cpu_status(nes, --nes->cpu.y_reg);
 }
 
-void exec_eor_op(NES *nes, Inst *inst) {
-    update_cpu_status(nes, nes->cpu->acc_reg ^= inst->operand_val);
+void exec_eor_op(NES *nes, const Inst *inst) {
+    update_cpu_status(nes, nes->cpu.acc_reg ^= nes->cpu.operand_val);
 }
 
-void exec_inc_op(NES *nes, Inst *inst) {
-    inst->page_cross_cycles = 0; // resolve difference in absolute x addressing mode cycles
-    update_cpu_status(nes, ++(*access_ram(nes->ram, inst->operand_mem_addr)));
+void exec_inc_op(NES *nes, const Inst *inst) {
+    uint8_t result = nes->cpu.operand_val + 1;
+    write_mem(nes, nes->cpu.operand_mem_addr, result);
+    update_cpu_status(nes, result);
 }
 
 void exec_inx_op(NES *nes) {
-    update_cpu_status(nes, ++nes->cpu->x_reg);
+    update_cpu_status(nes, ++nes->cpu.x_reg);
 }
 
 void exec_iny_op(NES *nes) {
-    update_cpu_status(nes, ++nes->cpu->y_reg);
+    update_cpu_status(nes, ++nes->cpu.y_reg);
 }
 
-void exec_jmp_op(NES *nes, Inst *inst) {
+void exec_jmp_op(NES *nes, const Inst *inst) {
     uint16_t operand;
     if (inst->addr_mode == ABSOLUTE) {
-        operand = inst->operand_mem_addr;
+        operand = nes->cpu.operand_mem_addr;
     } else { // INDIRECT memory addressing mode
-        if ((inst->operand_mem_addr & 0xff) == 0xff) { // emulate 6502 page boundary bug
-            operand = (*access_ram(nes->ram, inst->operand_mem_addr & 0xff00) << 8) | // most significant bits from 0x__00
-                *access_ram(nes->ram, inst->operand_mem_addr); // normal least significant bits
+        if ((nes->cpu.operand_mem_addr & 0xff) == 0xff) { // emulate 6502 page boundary bug
+            operand = (read_mem(nes, nes->cpu.operand_mem_addr & 0xff00) << 8) | // most significant bits from 0x__00
+                read_mem(nes, nes->cpu.operand_mem_addr); // normal least significant bits
         } else {
-            operand = inst->operand_val;
+            operand = nes->cpu.operand_val;
         }
     }
 
-    nes->cpu->program_c = operand;
+    nes->cpu.program_c = operand;
 }
 
-void exec_jsr_op(NES *nes, Inst *inst) {
-    stack_push16(nes, inst->operand_mem_addr - 1);
-    nes->cpu->program_c = inst->operand_mem_addr;
+void exec_jsr_op(NES *nes, const Inst *inst) {
+    stack_push16(nes, nes->cpu.program_c - 1); // return address minus one, program counter already points past jsr
+    nes->cpu.program_c = nes->cpu.operand_mem_addr;
 } 
 
-void exec_lda_op(NES *nes, Inst *inst) {
-    update_cpu_status(nes, nes->cpu->acc_reg = inst->operand_val);
+void exec_lda_op(NES *nes, const Inst *inst) {
+    update_cpu_status(nes, nes->cpu.acc_reg = nes->cpu.operand_val);
 }
 
-void exec_ldx_op(NES *nes, Inst *inst) {
-    update_cpu_status(nes, nes->cpu->x_reg = inst->operand_val);
+void exec_ldx_op(NES *nes, const Inst *inst) {
+    update_cpu_status(nes, nes->cpu.x_reg = nes->cpu.operand_val);
 }
 
-void exec_ldy_op(NES *nes, Inst *inst) {
-    update_cpu_status(nes, nes->cpu->y_reg = inst->operand_val);
+void exec_ldy_op(NES *nes, const Inst *inst) {
+    update_cpu_status(nes, nes->cpu.y_reg = nes->cpu.operand_val);
 }
 
-void exec_lsr_op(NES *nes, Inst *inst) {
-    inst->page_cross_cycles = 0; // resolve difference in absolute x addressing mode cycles
-
+void exec_lsr_op(NES *nes, const Inst *inst) {
     uint8_t operand;
     if (inst->addr_mode == ACCUMULATOR) {
-        set_cpu_status_bit(nes->cpu, CARRY, get_bit(nes->cpu->acc_reg, 7)); // most significant bit moved to carry
-        operand = (nes->cpu->acc_reg >>= 1);
+        set_cpu_status_bit(&nes->cpu, CARRY, get_bit(nes->cpu.acc_reg, 7)); // most significant bit moved to carry
+        operand = (nes->cpu.acc_reg >>= 1);
     } else { // shift memory contents
-        set_cpu_status_bit(nes->cpu, CARRY, get_bit(*access_ram(nes->ram, inst->operand_mem_addr), 7)); // most significant bit moved to carry
-        operand = (*access_ram(nes->ram, inst->operand_mem_addr) >>= 1);
+        set_cpu_status_bit(&nes->cpu, CARRY, get_bit(nes->cpu.operand_val, 7)); // most significant bit moved to carry
+        operand = nes->cpu.operand_val >> 1;
+        write_mem(nes, nes->cpu.operand_mem_addr, operand);
     }
-    set_cpu_status_bit(nes->cpu, ZERO, !operand);
-    set_cpu_status_bit(nes->cpu, NEGATIVE, get_bit(operand, 7));
+    set_cpu_status_bit(&nes->cpu, ZERO, !operand);
+    set_cpu_status_bit(&nes->cpu, NEGATIVE, get_bit(operand, 7));
 }
 
-void exec_ora_op(NES *nes, Inst *inst) {
-    update_cpu_status(nes, nes->cpu->acc_reg |= inst->operand_val);
+void exec_ora_op(NES *nes, const Inst *inst) {
+    update_cpu_status(nes, nes->cpu.acc_reg |= nes->cpu.operand_val);
 }
 
 void exec_pha_op(NES *nes) {
-    stack_push(nes, nes->cpu->acc_reg);
+    stack_push(nes, nes->cpu.acc_reg);
 }
 
 void exec_php_op(NES *nes) {
-    stack_push(nes, nes->cpu->status_reg);
+    stack_push(nes, nes->cpu.status_reg);
 }
 
 void exec_pla_op(NES *nes) {
-    update_cpu_status(nes, nes->cpu->acc_reg = stack_pull(nes));
+    update_cpu_status(nes, nes->cpu.acc_reg = stack_pull(nes));
 }
 
 void exec_plp_op(NES *nes) {
-    nes->cpu->status_reg = stack_pull(nes);
+    nes->cpu.status_reg = stack_pull(nes);
 }
 
-void exec_rol_op(NES *nes, Inst *inst) {
-    inst->page_cross_cycles = 0; // resolve difference in absolute x addressing mode cycles
-
+void exec_rol_op(NES *nes, const Inst *inst) {
     if (inst->addr_mode == ACCUMULATOR) {
-        bool new_carry = get_bit(nes->cpu->acc_reg, 7);
-        nes->cpu->acc_reg <<= 1;
-        set_bit(&nes->cpu->acc_reg, 0, get_cpu_status_bit(nes->cpu, CARRY));
-        set_cpu_status_bit(nes->cpu, CARRY, new_carry);
-        set_cpu_status_bit(nes->cpu, ZERO, !nes->cpu->acc_reg);
-        set_cpu_status_bit(nes->cpu, NEGATIVE, get_bit(nes->cpu->acc_reg, 7));
+        bool new_carry = get_bit(nes->cpu.acc_reg, 7);
+        nes->cpu.acc_reg <<= 1;
+        set_bit(&nes->cpu.acc_reg, 0, get_cpu_status_bit(&nes->cpu, CARRY));
+        set_cpu_status_bit(&nes->cpu, CARRY, new_carry);
+        set_cpu_status_bit(&nes->cpu, ZERO, !nes->cpu.acc_reg);
+        set_cpu_status_bit(&nes->cpu, NEGATIVE, get_bit(nes->cpu.acc_reg, 7));
     } else { // rotate memory value
-        bool new_carry = get_bit(inst->operand_val, 7);
-        uint8_t *byte = access_ram(nes->ram, inst->operand_mem_addr);
-        *byte <<= 1;
-        set_bit(byte, 0, get_cpu_status_bit(nes->cpu, CARRY));
-        set_cpu_status_bit(nes->cpu, CARRY, new_carry);
-        set_cpu_status_bit(nes->cpu, ZERO, !(*byte));
-        set_cpu_status_bit(nes->cpu, NEGATIVE, get_bit(*byte, 7));
+        bool new_carry = get_bit(nes->cpu.operand_val, 7);
+        uint8_t byte = nes->cpu.operand_val << 1;
+        set_bit(&byte, 0, get_cpu_status_bit(&nes->cpu, CARRY));
+        write_mem(nes, nes->cpu.operand_mem_addr, byte);
+        set_cpu_status_bit(&nes->cpu, CARRY, new_carry);
+        set_cpu_status_bit(&nes->cpu, ZERO, !byte);
+        set_cpu_status_bit(&nes->cpu, NEGATIVE, get_bit(byte, 7));
     }
 }
 
-void exec_ror_op(NES *nes, Inst *inst) {
-    inst->page_cross_cycles = 0; // resolve difference in absolute x addressing mode cycles
-
+void exec_ror_op(NES *nes, const Inst *inst) {
     if (inst->addr_mode == ACCUMULATOR) {
-        bool new_carry = get_bit(nes->cpu->acc_reg, 0);
-        nes->cpu->acc_reg >>= 1;
-        set_bit(&nes->cpu->acc_reg, 7, get_cpu_status_bit(nes->cpu, CARRY));
-        set_cpu_status_bit(nes->cpu, CARRY, new_carry);
-        set_cpu_status_bit(nes->cpu, ZERO, !nes->cpu->acc_reg);
-        set_cpu_status_bit(nes->cpu, NEGATIVE, get_bit(nes->cpu->acc_reg, 7));
+        bool new_carry = get_bit(nes->cpu.acc_reg, 0);
+        nes->cpu.acc_reg >>= 1;
+        set_bit(&nes->cpu.acc_reg, 7, get_cpu_status_bit(&nes->cpu, CARRY));
+        set_cpu_status_bit(&nes->cpu, CARRY, new_carry);
+        set_cpu_status_bit(&nes->cpu, ZERO, !nes->cpu.acc_reg);
+        set_cpu_status_bit(&nes->cpu, NEGATIVE, get_bit(nes->cpu.acc_reg, 7));
     } else { // rotate memory value
-        bool new_carry = get_bit(inst->operand_val, 0);
-        uint8_t *byte = access_ram(nes->ram, inst->operand_mem_addr);
-        *byte >>= 1;
-        set_bit(byte, 7, get_cpu_status_bit(nes->cpu, CARRY));
-        set_cpu_status_bit(nes->cpu, CARRY, new_carry);
-        set_cpu_status_bit(nes->cpu, ZERO, !(*byte));
-        set_cpu_status_bit(nes->cpu, NEGATIVE, get_bit(*byte, 7));
+        bool new_carry = get_bit(nes->cpu.operand_val, 0);
+        uint8_t byte = nes->cpu.operand_val >> 1;
+        set_bit(&byte, 7, get_cpu_status_bit(&nes->cpu, CARRY));
+        write_mem(nes, nes->cpu.operand_mem_addr, byte);
+        set_cpu_status_bit(&nes->cpu, CARRY, new_carry);
+        set_cpu_status_bit(&nes->cpu, ZERO, !byte);
+        set_cpu_status_bit(&nes->cpu, NEGATIVE, get_bit(byte, 7));
     }
 }
 
 void exec_rti_op(NES *nes) {
-    nes->cpu->status_reg = stack_pull(nes);
-    nes->cpu->program_c = stack_pull16(nes);
+    nes->cpu.status_reg = stack_pull(nes);
+    nes->cpu.program_c = stack_pull16(nes);
 }
 
 void exec_rts_op(NES *nes) {
-    nes->cpu->program_c = stack_pull16(nes);
+    nes->cpu.program_c = stack_pull16(nes) + 1;
 }
 
-void exec_sbc_op(NES *nes, Inst *inst) {
-    uint16_t difference = nes->cpu->acc_reg - inst->operand_val - !get_cpu_status_bit(nes->cpu, CARRY); // signed, higher-precision value to check for overflow, carry
-    set_cpu_status_bit(nes->cpu, OVERFLOW, 
-            (nes->cpu->acc_reg ^ difference) & (inst->operand_val ^ difference) & 0x80); // overflow formula courtesy of http://www.righto.com/2012/12/the-6502-overflow-flag-explained.html
-    nes->cpu->acc_reg -= inst->operand_val - !get_cpu_status_bit(nes->cpu, CARRY);
-    set_cpu_status_bit(nes->cpu, CARRY, difference > 255);
-    set_cpu_status_bit(nes->cpu, ZERO, !difference);
-    set_cpu_status_bit(nes->cpu, NEGATIVE, get_bit(nes->cpu->acc_reg, 7));
+void exec_sbc_op(NES *nes, const Inst *inst) {
+    uint16_t difference = nes->cpu.acc_reg - nes->cpu.operand_val - !get_cpu_status_bit(&nes->cpu, CARRY); // signed, higher-precision value to check for overflow, carry
+    set_cpu_status_bit(&nes->cpu, OVERFLOW, 
+            (nes->cpu.acc_reg ^ difference) & (nes->cpu.operand_val ^ difference) & 0x80); // overflow formula courtesy of http://www.righto.com/2012/12/the-6502-overflow-flag-explained.html
+    nes->cpu.acc_reg -= nes->cpu.operand_val - !get_cpu_status_bit(&nes->cpu, CARRY);
+    set_cpu_status_bit(&nes->cpu, CARRY, difference > 255);
+    set_cpu_status_bit(&nes->cpu, ZERO, !difference);
+    set_cpu_status_bit(&nes->cpu, NEGATIVE, get_bit(nes->cpu.acc_reg, 7));
 }
 
 void exec_sec_op(NES *nes) {
-    set_cpu_status_bit(nes->cpu, CARRY, 1);
+    set_cpu_status_bit(&nes->cpu, CARRY, 1);
 }
 
 void exec_sed_op(NES *nes) {
-    set_cpu_status_bit(nes->cpu, DECIMAL, 1);
+    set_cpu_status_bit(&nes->cpu, DECIMAL, 1);
 }
 
 void exec_sei_op(NES *nes) {
-    set_cpu_status_bit(nes->cpu, IRQ_DISABLE, 1);
+    set_cpu_status_bit(&nes->cpu, IRQ_DISABLE, 1);
 }
 
-void exec_sta_op(NES *nes, Inst *inst) {
-    *access_ram(nes->ram, inst->operand_mem_addr) = nes->cpu->acc_reg;
+void exec_sta_op(NES *nes, const Inst *inst) {
+    write_mem(nes, nes->cpu.operand_mem_addr, nes->cpu.acc_reg);
 }
 
-void exec_stx_op(NES *nes, Inst *inst) {
-    *access_ram(nes->ram, inst->operand_mem_addr) = nes->cpu->x_reg;
+void exec_stx_op(NES *nes, const Inst *inst) {
+    write_mem(nes, nes->cpu.operand_mem_addr, nes->cpu.x_reg);
 }
 
-void exec_sty_op(NES *nes, Inst *inst) {
-    *access_ram(nes->ram, inst->operand_mem_addr) = nes->cpu->y_reg;
+void exec_sty_op(NES *nes, const Inst *inst) {
+    write_mem(nes, nes->cpu.operand_mem_addr, nes->cpu.y_reg);
 }
 
 void exec_tax_op(NES *nes) {
-    update_cpu_status(nes, nes->cpu->x_reg = nes->cpu->acc_reg);
+    update_cpu_status(nes, nes->cpu.x_reg = nes->cpu.acc_reg);
 }
 
 void exec_tay_op(NES *nes) {
-    update_cpu_status(nes, nes->cpu->y_reg = nes->cpu->acc_reg);
+    update_cpu_status(nes, nes->cpu.y_reg = nes->cpu.acc_reg);
 }
 
 void exec_tsx_op(NES *nes) {
-    update_cpu_status(nes, nes->cpu->x_reg = nes->cpu->stack_p);
+    update_cpu_status(nes, nes->cpu.x_reg = nes->cpu.stack_p);
 }
 
 void exec_txa_op(NES *nes) {
-    update_cpu_status(nes, nes->cpu->acc_reg = nes->cpu->x_reg);
+    update_cpu_status(nes, nes->cpu.acc_reg = nes->cpu.x_reg);
 }
 
 void exec_txs_op(NES *nes) {
-    nes->cpu->stack_p = nes->cpu->x_reg;
+    nes->cpu.stack_p = nes->cpu.x_reg;
 }
 
 void exec_tya_op(NES *nes) {
-    update_cpu_status(nes, nes->cpu->acc_reg = nes->cpu->y_reg);
+    update_cpu_status(nes, nes->cpu.acc_reg = nes->cpu.y_reg);
 }
 
-void exec_inst(NES *nes, Inst *inst) {
-    update_inst_operand(nes, inst);
+// executes instruction, returns cycles it took and adds them to the cpu cycle counter
+unsigned exec_inst(NES *nes, const Inst *inst) {
+    unsigned cycles = inst->cycles;
+    if (update_inst_operand(nes, inst)) { // indexed read crossed a page boundary
+        cycles += inst->page_cross_cycles;
+    }
+
     switch(inst->inst_type) {
         case ADC_OP:
             exec_adc_op(nes, inst);
@@ -469,34 +489,34 @@ void exec_inst(NES *nes, Inst *inst) {
             exec_asl_op(nes, inst);
             break;
         case BCC_OP:
-            exec_bcc_op(nes, inst);
+            cycles += exec_bcc_op(nes, inst);
             break;
         case BCS_OP:
-            exec_bcs_op(nes, inst);
+            cycles += exec_bcs_op(nes, inst);
             break;
         case BEQ_OP:
-            exec_beq_op(nes, inst);
+            cycles += exec_beq_op(nes, inst);
             break;
         case BIT_OP:
             exec_bit_op(nes, inst);
             break;
         case BMI_OP:
-            exec_bmi_op(nes, inst);
+            cycles += exec_bmi_op(nes, inst);
             break;
         case BNE_OP:
-            exec_bne_op(nes, inst);
+            cycles += exec_bne_op(nes, inst);
             break;
         case BPL_OP:
-            exec_bpl_op(nes, inst);
+            cycles += exec_bpl_op(nes, inst);
             break;
         case BRK_OP:
             exec_brk_op(nes);
             break;
         case BVC_OP:
-            exec_bvc_op(nes, inst);
+            cycles += exec_bvc_op(nes, inst);
             break;
         case BVS_OP:
-            exec_bvs_op(nes, inst);
+            cycles += exec_bvs_op(nes, inst);
             break;
         case CLC_OP:
             exec_clc_op(nes);
@@ -517,7 +537,7 @@ void exec_inst(NES *nes, Inst *inst) {
             exec_cpx_op(nes, inst);
             break;
         case CPY_OP:
-            exec_cpx_op(nes, inst);
+            exec_cpy_op(nes, inst);
             break;
         case DEC_OP:
             exec_dec_op(nes, inst);
@@ -607,7 +627,7 @@ void exec_inst(NES *nes, Inst *inst) {
             exec_sty_op(nes, inst);
             break;
         case TAX_OP:
-            exec_sty_op(nes, inst);
+            exec_tax_op(nes);
             break;
         case TAY_OP:
             exec_tay_op(nes);
@@ -627,11 +647,13 @@ void exec_inst(NES *nes, Inst *inst) {
         case NOP:
             break;
         default:
-            delete_nes(nes);
-            fprintf(stderr, "Unsupported opcode");
-            exit(-1);
-            break;
+            halt_nes(nes, NES_INVALID_INSTRUCTION);
+            return 0;
     }
+
+    nes->cpu.cycles += cycles;
+    nes->cpu.insts++;
+    return cycles;
 }
 
 void classify_inst(uint8_t opcode, Inst *inst) {
@@ -28,72 +28,84 @@ typedef enum INST_OP {
         TSX_OP,        TXA_OP,        TXS_OP,        TYA_OP
 } INST_OP;
 
+// superinstructions, a fused pair is tagged on its first instruction
+typedef enum FUSED_OP {
+        FUSE_NONE,
+        FUSE_LDA_ZP_STA_ABS,    // copy zero page byte to absolute address
+        FUSE_CMP_IMM_BNE,       // compare accumulator against constant and branch
+        FUSE_DEX_BNE,           // count-down loop
+        FUSE_CLC_ADC_IMM,       // add constant without carry in
+        FUSE_INC_ZP_LDA_ZP,     // increment zero page byte and load result
+        FUSE_BREAKPOINT         // debugger breakpoint, stops the console before the instruction runs
+} FUSED_OP;
+
 typedef struct Inst {
-        uint8_t *body;                          // operands of instruction
+        uint8_t body[2];                        // operands of instruction
         unsigned size_bytes;                    // size of instruction, including opcode and operands
         unsigned cycles;                        // cycles required to execute instruction
-        unsigned page_cross_cycles;             // additional cycles if page crossed
+        unsigned page_cross_cycles;             // additional cycles if page crossed (indexed read, or taken branch)
         unsigned branch_succeeds_cycles;        // additional cycles if branch successful
         ADDR_MODE addr_mode;                     // addressing mode of instruction
         INST_OP inst_type;                      // operation executed by instruction
-        uint16_t operand_val;                   // value of operand used by instruction (memory locations accessed, jump relative distance)
-        uint16_t operand_mem_addr;              // memory address of operand for stores
-} Inst;
+        FUSED_OP fused;                         // superinstruction starting here, if any
+} Inst; // immutable once decoded, operands are resolved into cpu scratch space per execution
 
 void classify_inst(uint8_t opcode, Inst *inst);
 void parse_insts(ROM *rom);
-void exec_inst(NES *nes, Inst *inst);
-void exec_branch(NES *nes, Inst *inst, bool condition);
+const Inst *fetch_inst(NES *nes, uint16_t addr, Inst *scratch);
+bool update_inst_operand(NES *nes, const Inst *inst);
+unsigned exec_inst(NES *nes, const Inst *inst);
+unsigned exec_branch(NES *nes, const Inst *inst, bool condition);
 void update_cpu_status(NES *nes, uint8_t value);
-void exec_adc_op(NES *nes, Inst *inst);
-void exec_and_op(NES *nes, Inst *inst);
-void exec_asl_op(NES *nes, Inst *inst);
-void exec_bcc_op(NES *nes, Inst *inst);
-void exec_bcs_op(NES *nes, Inst *inst);
-void exec_beq_op(NES *nes, Inst *inst);
-void exec_bit_op(NES *nes, Inst *inst);
-void exec_bmi_op(NES *nes, Inst *inst);
-void exec_bne_op(NES *nes, Inst *inst);
-void exec_bpl_op(NES *nes, Inst *inst);
+void exec_adc_op(NES *nes, const Inst *inst);
+void exec_and_op(NES *nes, const Inst *inst);
+void exec_asl_op(NES *nes, const Inst *inst);
+unsigned exec_bcc_op(NES *nes, const Inst *inst);
+unsigned exec_bcs_op(NES *nes, const Inst *inst);
+unsigned exec_beq_op(NES *nes, const Inst *inst);
+void exec_bit_op(NES *nes, const Inst *inst);
+unsigned exec_bmi_op(NES *nes, const Inst *inst);
+unsigned exec_bne_op(NES *nes, const Inst *inst);
+unsigned exec_bpl_op(NES *nes, const Inst *inst);
 void exec_brk_op(NES *nes);
-void exec_bvc_op(NES *nes, Inst *inst);
-void exec_bvs_op(NES *nes, Inst *inst);
+unsigned exec_bvc_op(NES *nes, const Inst *inst);
+unsigned exec_bvs_op(NES *nes, const Inst *inst);
 void exec_clc_op(NES *nes);
 void exec_cld_op(NES *nes);
 void exec_cli_op(NES *nes);
 void exec_clv_op(NES *nes);
-void exec_cmp_op(NES *nes, Inst *inst);
-void exec_cpx_op(NES *nes, Inst *inst);
-void exec_cpy_op(NES *nes, Inst *inst);
-void exec_dec_op(NES *nes, Inst *inst);
+void exec_cmp_op(NES *nes, const Inst *inst);
+void exec_cpx_op(NES *nes, const Inst *inst);
+void exec_cpy_op(NES *nes, const Inst *inst);
+void exec_dec_op(NES *nes, const Inst *inst);
 void exec_dex_op(NES *nes);
 void exec_dey_op(NES *nes);
-void exec_eor_op(NES *nes, Inst *inst);
-void exec_inc_op(NES *nes, Inst *inst);
+void exec_eor_op(NES *nes, const Inst *inst);
+void exec_inc_op(NES *nes, const Inst *inst);
 void exec_inx_op(NES *nes);
 void exec_iny_op(NES *nes);
-void exec_jmp_op(NES *nes, Inst *inst);
-void exec_jsr_op(NES *nes, Inst *inst);
-void exec_lda_op(NES *nes, Inst *inst);
-void exec_ldx_op(NES *nes, Inst *inst);
-void exec_ldy_op(NES *nes, Inst *inst);
-void exec_lsr_op(NES *nes, Inst *inst);
-void exec_ora_op(NES *nes, Inst *inst);
+void exec_jmp_op(NES *nes, const Inst *inst);
+void exec_jsr_op(NES *nes, const Inst *inst);
+void exec_lda_op(NES *nes, const Inst *inst);
+void exec_ldx_op(NES *nes, const Inst *inst);
+void exec_ldy_op(NES *nes, const Inst *inst);
+void exec_lsr_op(NES *nes, const Inst *inst);
+void exec_ora_op(NES *nes, const Inst *inst);
 void exec_pha_op(NES *nes);
 void exec_php_op(NES *nes);
 void exec_pla_op(NES *nes);
 void exec_plp_op(NES *nes);
-void exec_rol_op(NES *nes, Inst *inst);
-void exec_ror_op(NES *nes, Inst *inst);
+void exec_rol_op(NES *nes, const Inst *inst);
+void exec_ror_op(NES *nes, const Inst *inst);
 void exec_rti_op(NES *nes);
 void exec_rts_op(NES *nes);
-void exec_sbc_op(NES *nes, Inst *inst);
+void exec_sbc_op(NES *nes, const Inst *inst);
 void exec_sec_op(NES *nes);
 void exec_sed_op(NES *nes);
 void exec_sei_op(NES *nes);
-void exec_sta_op(NES *nes, Inst *inst);
-void exec_stx_op(NES *nes, Inst *inst);
-void exec_sty_op(NES *nes, Inst *inst);
+void exec_sta_op(NES *nes, const Inst *inst);
+void exec_stx_op(NES *nes, const Inst *inst);
+void exec_sty_op(NES *nes, const Inst *inst);
 void exec_tax_op(NES *nes);
 void exec_tay_op(NES *nes);
 void exec_tsx_op(NES *nes);
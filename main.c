@@ -1,11 +1,163 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include "instruction.h"
 #include "nes.h"
+#include "wide.h"
+#include "export.h"
+#include "hash.h"
+#include "analysis.h"
+#include "native.h"
+#include "romcache.h"
+#include "scan.h"
+#include "runner.h"
+#include "gdbstub.h"
+#include <unistd.h>
+
+// opens a movie, one port 0 button byte per frame, returning its frame count through frames
+static uint8_t *load_movie(const char *path, unsigned *frames) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    uint8_t *inputs = (uint8_t*) malloc(size > 0 ? size : 1);
+    *frames = fread(inputs, 1, size > 0 ? size : 0, file);
+    fclose(file);
+    return inputs;
+}
+
+// maxnes scan <dir> [index], validates every rom below dir in parallel and writes a compact index
+static int scan_main(int argc, char *argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: maxnes scan <dir> [index=maxnes.index]\n");
+        return -1;
+    }
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    ROMLibrary *library = scan_roms(argv[2], cpus > 0 ? cpus : 1);
+
+    unsigned statuses[ROM_TRUNCATED + 1] = {0};
+    unsigned mappers[4096] = {0};
+    unsigned trainers = 0;
+    unsigned trailing = 0;
+    for (unsigned i = 0; i < library->count; i++) {
+        const ROMIndexEntry *entry = &library->entries[i];
+        statuses[entry->status]++;
+        if (entry->status == ROM_OK) {
+            mappers[entry->mapper]++;
+            trainers += (entry->flags & INDEX_TRAINER) != 0;
+            trailing += (entry->flags & INDEX_TRAILING_DATA) != 0;
+        }
+    }
+
+    printf("%u roms, %u with trainers, %u with trailing data\n", library->count, trainers, trailing);
+    for (unsigned status = 0; status <= ROM_TRUNCATED; status++) {
+        if (statuses[status]) {
+            printf("  %-20s %u\n", rom_status_name(status), statuses[status]);
+        }
+    }
+    for (unsigned mapper = 0; mapper < 4096; mapper++) {
+        if (mappers[mapper]) {
+            printf("  mapper %-4u %-13s %u\n", mapper, mapper_name(mapper), mappers[mapper]);
+        }
+    }
+
+    const char *index = argc > 3 ? argv[3] : "maxnes.index";
+    bool written = write_rom_index(library, index);
+    delete_rom_library(library);
+    if (!written) {
+        fprintf(stderr, "Error: unable to write index %s\n", index);
+        return -1;
+    }
+    return 0;
+}
+
+// maxnes bench <rom> [frames] [instances per worker], frames per second with pinned workers from one up to every cpu
+static int bench_main(int argc, char *argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: maxnes bench <rom> [frames=120] [instances per worker=4]\n");
+        return -1;
+    }
+    unsigned frames = argc > 3 ? strtoul(argv[3], NULL, 10) : 120;
+    unsigned per_worker = argc > 4 ? strtoul(argv[4], NULL, 10) : 4;
+    FILE *rom_file = fopen(argv[2], "rb");
+    if (rom_file == NULL) {
+        fprintf(stderr, "Error: unable to open file\n");
+        return -1;
+    }
+    ROM *rom = (ROM*) calloc(1, sizeof(ROM));
+    ROM_STATUS status = parse_rom(rom_file, rom);
+    fclose(rom_file);
+    if (status != ROM_OK) {
+        fprintf(stderr, "Error: rom %s\n", rom_status_name(status));
+        close_rom(rom);
+        return -1;
+    }
+    prepare_rom(rom);
+
+    Topology *topology = read_topology();
+    printf("%u cpus on %u numa nodes\n", topology->cpu_count, topology->node_count);
+    double single = 0;
+    for (unsigned workers = 1;; workers = workers * 2 < topology->cpu_count ? workers * 2 : topology->cpu_count) {
+        RunnerStats stats = run_pinned(rom, topology, workers, workers * per_worker, frames);
+        double fps = stats.frames / stats.seconds;
+        if (workers == 1) {
+            single = fps;
+        }
+        printf("%3u workers %5u instances %10.0f fps %6.2fx\n", stats.workers, stats.instances, fps, fps / single);
+        if (workers == topology->cpu_count) {
+            break;
+        }
+    }
+
+    delete_topology(topology);
+    close_rom(rom);
+    return 0;
+}
+
+// maxnes gdb <rom> <port|socket>, debugs the rom under a gdb remote serial protocol client
+static int gdb_main(int argc, char *argv[]) {
+    if (argc < 4) {
+        fprintf(stderr, "usage: maxnes gdb <rom> <tcp port|unix socket path>\n");
+        return -1;
+    }
+    FILE *rom_file = fopen(argv[2], "rb");
+    if (rom_file == NULL) {
+        fprintf(stderr, "Error: unable to open file\n");
+        return -1;
+    }
+    ROM *rom = (ROM*) calloc(1, sizeof(ROM));
+    ROM_STATUS status = parse_rom(rom_file, rom);
+    fclose(rom_file);
+    if (status != ROM_OK) {
+        fprintf(stderr, "Error: rom %s\n", rom_status_name(status));
+        close_rom(rom);
+        return -1;
+    }
+    prepare_rom(rom);
+
+    bool served = serve_gdb(rom, argv[3]);
+    close_rom(rom);
+    return served ? 0 : -1;
+}
 
 int main(int argc, char *argv[]) {
-    char *path = "mario.nes";
+    if (argc > 1 && !strcmp(argv[1], "scan")) {
+        return scan_main(argc, argv);
+    }
+    if (argc > 1 && !strcmp(argv[1], "bench")) {
+        return bench_main(argc, argv);
+    }
+    if (argc > 1 && !strcmp(argv[1], "gdb")) {
+        return gdb_main(argc, argv);
+    }
+
+    char *path = argc > 1 ? argv[1] : "mario.nes";
+    unsigned frames = argc > 2 ? strtoul(argv[2], NULL, 10) : 0; // frames to run headless
+    unsigned lanes = argc > 3 ? strtoul(argv[3], NULL, 10) : 0;  // lockstep lanes to benchmark
     FILE *rom_file = fopen(path, "rb");
 
     if (rom_file == NULL) {
@@ -13,18 +165,134 @@ int main(int argc, char *argv[]) {
         return -1;
     }
 
-    NES *nes = new_NES();
+    ROM *rom = (ROM*) calloc(1, sizeof(ROM));
 
-    if (!parse_rom(rom_file, nes->rom)) {
+    ROM_STATUS status = parse_rom(rom_file, rom);
+    if (status != ROM_OK) {
         fclose(rom_file);
-        fprintf(stderr, "Error: rom unrecognized format\n");
-        delete_nes(nes);
+        fprintf(stderr, "Error: rom %s\n", rom_status_name(status));
+        close_rom(rom);
         return -1;
     } else {
         fclose(rom_file);
-        parse_insts(nes->rom);
+        prepare_rom(rom);
+    }
+
+    if (getenv("MAXNES_ANALYZE")) { // static control flow, cached with the decoded rom
+        const Analysis *analysis = rom->analysis;
+        unsigned code_bytes = 0;
+        for (unsigned i = 0; i < rom->prg_len; i++) {
+            code_bytes += is_code(analysis, rom, prg_address(rom, i));
+        }
+        printf("%u of %u prg bytes are code, %u blocks, %u jump tables\n", code_bytes, rom->prg_len,
+                analysis->block_count, analysis->table_count);
+    }
+
+    if (getenv("MAXNES_RECOMPILE")) { // write the rom as c source for a native plugin, then exit
+        FILE *source = fopen(getenv("MAXNES_RECOMPILE"), "w");
+        bool written = source && emit_native_source(rom, rom->analysis, source);
+        if (source) {
+            fclose(source);
+        }
+        close_rom(rom);
+        if (!written) {
+            fprintf(stderr, "Error: unable to write recompiled source\n");
+            return -1;
+        }
+        return 0;
+    }
+    if (getenv("MAXNES_NATIVE") && !load_native(rom, getenv("MAXNES_NATIVE"))) { // run known blocks natively
+        close_rom(rom);
+        return -1;
+    }
+
+    if (lanes) {
+        bench_wide(rom, lanes, frames);
+        close_rom(rom);
+        return 0;
+    }
+
+    Export *export = NULL;
+    if (getenv("MAXNES_EXPORT")) { // publish every frame to the named shared memory segment
+        export = new_export(getenv("MAXNES_EXPORT"));
+    }
+
+    uint8_t *movie = NULL;
+    unsigned movie_frames = 0;
+    if (getenv("MAXNES_MOVIE")) { // replay recorded inputs, runs the whole movie unless frames is given
+        movie = load_movie(getenv("MAXNES_MOVIE"), &movie_frames);
+        if (movie == NULL) {
+            fprintf(stderr, "Error: unable to open movie\n");
+            return -1;
+        }
+        frames = frames ? frames : movie_frames;
+    }
+
+    FILE *hash_log = NULL;
+    if (getenv("MAXNES_HASH_LOG")) { // record per-frame state hashes
+        hash_log = fopen(getenv("MAXNES_HASH_LOG"), "wb");
+        if (hash_log == NULL || !write_hash_log_header(hash_log)) {
+            fprintf(stderr, "Error: unable to write hash log\n");
+            return -1;
+        }
+    }
+
+    FILE *golden = NULL;
+    if (getenv("MAXNES_CHECK")) { // compare against a recorded hash log, stopping at the first divergence
+        golden = fopen(getenv("MAXNES_CHECK"), "rb");
+        if (golden == NULL || !read_hash_log_header(golden)) {
+            fprintf(stderr, "Error: unable to read golden hash log\n");
+            return -1;
+        }
     }
 
+    int result = 0;
+    NES *nes = new_NES(rom);
+    for (unsigned i = 0; i < frames; i++) {
+        nes->controllers[0].buttons = i < movie_frames ? movie[i] : 0;
+        run_frame(nes);
+        if (export) {
+            publish_frame(export, nes);
+        }
+        if (!hash_log && !golden) {
+            continue;
+        }
+
+        FrameHash hash;
+        hash_frame(nes, &hash);
+        if (hash_log) {
+            fwrite(&hash, sizeof(hash), 1, hash_log);
+        }
+        FrameHash expected;
+        if (golden && fread(&expected, sizeof(expected), 1, golden) != 1) {
+            printf("golden log ends after %u frames\n", i);
+            fclose(golden);
+            golden = NULL;
+        } else if (golden && memcmp(&hash, &expected, sizeof(hash))) {
+            printf("frame %u differs:%s%s%s\n", i + 1,
+                    hash.framebuffer != expected.framebuffer ? " framebuffer" : "",
+                    hash.ram != expected.ram ? " ram" : "",
+                    hash.cpu != expected.cpu ? " cpu" : "");
+            frames = i + 1;
+            result = 1;
+        }
+    }
+    if (frames) {
+        printf("%u frames, %llu cycles, %llu idle cycles skipped\n", frames,
+                (unsigned long long) nes->cpu.cycles, (unsigned long long) nes->idle.skipped);
+    }
+
+    if (export) {
+        delete_export(export);
+    }
+    if (hash_log) {
+        fclose(hash_log);
+    }
+    if (golden) {
+        fclose(golden);
+    }
+    free(movie);
     delete_nes(nes);
-    return 0;
+    close_rom(rom);
+    return result;
 }
@@ -0,0 +1,420 @@
+#include "maxnes.h"
+#include "nes.h"
+#include "threadpool.h"
+#include "observation.h"
+#include "palette.h"
+#include "hash.h"
+#include "romcache.h"
+#include "pool.h"
+#include <string.h>
+#include <unistd.h>
+
+// decoded rom shared by every handle cloned from the one that loaded it
+typedef struct SharedROM {
+    ROM *rom;
+    unsigned refs;
+    NESPool *pool;          // preallocated consoles for clones, if reserved
+} SharedROM;
+
+struct MaxNES {
+    SharedROM *shared;
+    NES *nes;
+};
+
+struct MaxNESBatch {
+    ThreadPool *pool;
+    MaxNESObservation processed; // conversion used for MAXNES_OBS_PROCESSED
+};
+
+static int nes_status(const NES *nes) {
+    switch (nes->status) {
+        case NES_OK:
+            return MAXNES_OK;
+        case NES_DEBUG_STOP: // only raised while a debugger is attached
+            return MAXNES_OK;
+        case NES_INVALID_INSTRUCTION:
+            return MAXNES_ERR_INVALID_INSTRUCTION;
+    }
+    return MAXNES_ERR_INVALID_INSTRUCTION;
+}
+
+MaxNES *maxnes_create(void) {
+    return (MaxNES*) calloc(1, sizeof(MaxNES));
+}
+
+static void unload(MaxNES *maxnes) {
+    NESPool *pool = maxnes->shared ? maxnes->shared->pool : NULL;
+    if (maxnes->nes && pool && pool_owns(pool, maxnes->nes)) {
+        release_nes(pool, maxnes->nes);
+    } else if (maxnes->nes) {
+        delete_nes(maxnes->nes);
+    }
+    maxnes->nes = NULL;
+    if (maxnes->shared && __atomic_sub_fetch(&maxnes->shared->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        if (pool) {
+            delete_nes_pool(pool);
+        }
+        close_rom(maxnes->shared->rom);
+        free(maxnes->shared);
+    }
+    maxnes->shared = NULL;
+}
+
+void maxnes_destroy(MaxNES *maxnes) {
+    if (maxnes) {
+        unload(maxnes);
+        free(maxnes);
+    }
+}
+
+// loads an ines image from memory and powers the console on, replacing any loaded rom
+int maxnes_load_rom(MaxNES *maxnes, const uint8_t *data, size_t size) {
+    if (!maxnes || !data) {
+        return MAXNES_ERR_ARGUMENT;
+    }
+    unload(maxnes);
+
+    ROM *rom = (ROM*) calloc(1, sizeof(ROM));
+    if (parse_rom_memory(data, size, rom) != ROM_OK) {
+        close_rom(rom);
+        return MAXNES_ERR_ROM_FORMAT;
+    }
+    prepare_rom(rom);
+
+    maxnes->shared = (SharedROM*) calloc(1, sizeof(SharedROM));
+    maxnes->shared->rom = rom;
+    maxnes->shared->refs = 1;
+    maxnes->nes = new_NES(rom);
+    return MAXNES_OK;
+}
+
+// new powered-on console running the same rom, sharing its decoded image instead of copying it
+// taken from the reserved pool while it has free slots
+MaxNES *maxnes_clone(const MaxNES *source) {
+    if (!source || !source->nes) {
+        return NULL;
+    }
+
+    MaxNES *maxnes = maxnes_create();
+    __atomic_add_fetch(&source->shared->refs, 1, __ATOMIC_RELAXED);
+    maxnes->shared = source->shared;
+    maxnes->nes = source->shared->pool ? acquire_nes(source->shared->pool) : NULL;
+    if (!maxnes->nes) {
+        maxnes->nes = new_NES(source->shared->rom);
+    }
+    return maxnes;
+}
+
+// preallocates count consoles that later clones of this rom are recycled through, so creating and
+// destroying clones neither allocates nor rebuilds the console, must precede cloning and happen once per rom
+int maxnes_reserve(MaxNES *maxnes, unsigned count) {
+    if (!maxnes || !maxnes->nes) {
+        return MAXNES_ERR_NO_ROM;
+    }
+    if (!count || maxnes->shared->pool) {
+        return MAXNES_ERR_ARGUMENT;
+    }
+    maxnes->shared->pool = new_nes_pool(maxnes->shared->rom, count);
+    return maxnes->shared->pool ? MAXNES_OK : MAXNES_ERR_ARGUMENT;
+}
+
+int maxnes_reset(MaxNES *maxnes) {
+    if (!maxnes || !maxnes->nes) {
+        return MAXNES_ERR_NO_ROM;
+    }
+    reset_nes(maxnes->nes);
+    return MAXNES_OK;
+}
+
+// runs until the current frame is complete
+int maxnes_step_frame(MaxNES *maxnes) {
+    if (!maxnes || !maxnes->nes) {
+        return MAXNES_ERR_NO_ROM;
+    }
+    run_frame(maxnes->nes);
+    return nes_status(maxnes->nes);
+}
+
+// sets buttons held on controller port 0 or 1, one bit per button in A, B, Select, Start, Up, Down, Left, Right order
+int maxnes_set_input(MaxNES *maxnes, unsigned port, uint8_t buttons) {
+    if (!maxnes || !maxnes->nes) {
+        return MAXNES_ERR_NO_ROM;
+    }
+    if (port > 1) {
+        return MAXNES_ERR_ARGUMENT;
+    }
+    maxnes->nes->controllers[port].buttons = buttons;
+    return MAXNES_OK;
+}
+
+// palette indices of the last completed frame, row-major MAXNES_SCREEN_WIDTH x MAXNES_SCREEN_HEIGHT
+const uint8_t *maxnes_get_framebuffer(const MaxNES *maxnes) {
+    return maxnes && maxnes->nes ? ppu_frame(&maxnes->nes->ppu) : NULL;
+}
+
+// color emphasis bits the last frame was drawn with, needed to turn its indices into colors
+int maxnes_get_emphasis(const MaxNES *maxnes) {
+    return maxnes && maxnes->nes ? ppu_frame_emphasis(&maxnes->nes->ppu) : MAXNES_ERR_NO_ROM;
+}
+
+// hash of the last completed frame, equal hashes let callers skip storing or processing repeated frames
+uint64_t maxnes_frame_hash(const MaxNES *maxnes) {
+    if (!maxnes || !maxnes->nes) {
+        return 0;
+    }
+    const PPU *ppu = &maxnes->nes->ppu;
+    return hash64(ppu_frame(ppu), SCREEN_WIDTH * SCREEN_HEIGHT, ppu_frame_emphasis(ppu));
+}
+
+// converts the last completed frame to 0x00RRGGBB pixels, only frontends that display it need this
+int maxnes_get_rgb(const MaxNES *maxnes, uint32_t *out) {
+    if (!maxnes || !maxnes->nes) {
+        return MAXNES_ERR_NO_ROM;
+    }
+    if (!out) {
+        return MAXNES_ERR_ARGUMENT;
+    }
+    const PPU *ppu = &maxnes->nes->ppu;
+    palette_to_rgb(ppu_frame(ppu), SCREEN_WIDTH * SCREEN_HEIGHT, ppu_frame_emphasis(ppu), out);
+    return MAXNES_OK;
+}
+
+const uint8_t *maxnes_get_ram(const MaxNES *maxnes) {
+    return maxnes && maxnes->nes ? maxnes->nes->ram : NULL;
+}
+
+size_t maxnes_state_size(void) {
+    return nes_state_size();
+}
+
+int maxnes_save_state(const MaxNES *maxnes, void *buffer, size_t size) {
+    if (!maxnes || !maxnes->nes) {
+        return MAXNES_ERR_NO_ROM;
+    }
+    if (!buffer || size < nes_state_size()) {
+        return MAXNES_ERR_STATE;
+    }
+    save_nes_state(maxnes->nes, (uint8_t*) buffer);
+    return MAXNES_OK;
+}
+
+int maxnes_load_state(MaxNES *maxnes, const void *buffer, size_t size) {
+    if (!maxnes || !maxnes->nes) {
+        return MAXNES_ERR_NO_ROM;
+    }
+    if (!buffer || size < nes_state_size() || !load_nes_state(maxnes->nes, (const uint8_t*) buffer)) {
+        return MAXNES_ERR_STATE;
+    }
+    return MAXNES_OK;
+}
+
+size_t maxnes_delta_max_size(void) {
+    return nes_delta_max_size();
+}
+
+// incremental snapshot of the pages written since the previous delta, the untracked registers always included,
+// a chain starts from a freshly loaded rom or clone and is replayed in order with maxnes_load_delta
+int maxnes_save_delta(MaxNES *maxnes, void *buffer, size_t size, size_t *written) {
+    if (!maxnes || !maxnes->nes) {
+        return MAXNES_ERR_NO_ROM;
+    }
+    if (!buffer || !written || size < nes_delta_max_size()) {
+        return MAXNES_ERR_STATE;
+    }
+    *written = save_nes_delta(maxnes->nes, (uint8_t*) buffer);
+    return MAXNES_OK;
+}
+
+int maxnes_load_delta(MaxNES *maxnes, const void *buffer, size_t size) {
+    if (!maxnes || !maxnes->nes) {
+        return MAXNES_ERR_NO_ROM;
+    }
+    if (!buffer || !load_nes_delta(maxnes->nes, (const uint8_t*) buffer, size)) {
+        return MAXNES_ERR_STATE;
+    }
+    return MAXNES_OK;
+}
+
+// pages written during the last frame, bit i of word i / 64 for page i: cpu ram first, then sprite memory,
+// nametables, chr ram and both framebuffers one row per page, and the palette last,
+// copies as many words as fit and returns the total page count
+int maxnes_dirty_pages(const MaxNES *maxnes, uint64_t *bitmap, unsigned words) {
+    if (!maxnes || !maxnes->nes) {
+        return MAXNES_ERR_NO_ROM;
+    }
+    if (!bitmap && words) {
+        return MAXNES_ERR_ARGUMENT;
+    }
+    for (unsigned i = 0; i < words; i++) {
+        bitmap[i] = i < DIRTY_WORDS ? maxnes->nes->frame_dirty[i] : 0;
+    }
+    return DIRTY_PAGES;
+}
+
+_Static_assert(MAXNES_WATCH_READ == WATCH_READ && MAXNES_WATCH_WRITE == WATCH_WRITE && MAXNES_WATCH_CHANGE == WATCH_CHANGE,
+        "watch kinds are passed through");
+
+// watches length addresses from address for a combination of MAXNES_WATCH_* kinds, replacing the kinds set
+// before, 0 stops watching them; accesses to pages without watches run as fast as with none set
+int maxnes_watch(MaxNES *maxnes, uint16_t address, unsigned length, int kinds) {
+    if (!maxnes || !maxnes->nes) {
+        return MAXNES_ERR_NO_ROM;
+    }
+    if (kinds & ~(MAXNES_WATCH_READ | MAXNES_WATCH_WRITE | MAXNES_WATCH_CHANGE) || length > 0x10000u - address) {
+        return MAXNES_ERR_ARGUMENT;
+    }
+    for (unsigned i = 0; i < length; i++) {
+        set_watch(maxnes->nes, address + i, kinds);
+    }
+    return MAXNES_OK;
+}
+
+// moves up to capacity of the oldest buffered watch events to events, returns how many, meant to be
+// called once per stepped frame; dropped, if given, receives how many overflowed the buffer since the last call
+int maxnes_watch_events(MaxNES *maxnes, MaxNESWatchEvent *events, unsigned capacity, uint64_t *dropped) {
+    if (!maxnes || !maxnes->nes) {
+        return MAXNES_ERR_NO_ROM;
+    }
+    if (!events && capacity) {
+        return MAXNES_ERR_ARGUMENT;
+    }
+    WatchEvent batch[64];
+    uint64_t lost = 0, overflow;
+    unsigned count = 0, taken;
+    do {
+        unsigned chunk = capacity - count < 64 ? capacity - count : 64;
+        taken = take_watch_events(maxnes->nes, batch, chunk, &overflow);
+        lost += overflow;
+        for (unsigned i = 0; i < taken; i++) {
+            events[count++] = (MaxNESWatchEvent) {
+                batch[i].cycle, batch[i].frame, batch[i].addr, batch[i].pc, batch[i].kinds, batch[i].old_value, batch[i].value
+            };
+        }
+    } while (taken == 64);
+    if (dropped) {
+        *dropped = lost;
+    }
+    return (int) count;
+}
+
+// threads counts the calling thread, 0 picks one per online cpu
+MaxNESBatch *maxnes_batch_create(unsigned threads) {
+    if (!threads) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? cpus : 1;
+    }
+
+    MaxNESBatch *batch = (MaxNESBatch*) calloc(1, sizeof(MaxNESBatch));
+    batch->pool = new_thread_pool(threads);
+    batch->processed = (MaxNESObservation) {MAXNES_FORMAT_GRAY, 84, 84, 0, 0, 0, 0, 1}; // the usual atari-style input
+    return batch;
+}
+
+void maxnes_batch_destroy(MaxNESBatch *batch) {
+    if (batch) {
+        delete_thread_pool(batch->pool);
+        free(batch);
+    }
+}
+
+// writes spec->width * spec->height bytes converted from the last completed frame
+int maxnes_observe(const MaxNES *maxnes, const MaxNESObservation *spec, uint8_t *out) {
+    if (!maxnes || !maxnes->nes) {
+        return MAXNES_ERR_NO_ROM;
+    }
+    if (!spec || !out || !valid_observation(spec)) {
+        return MAXNES_ERR_ARGUMENT;
+    }
+    const PPU *ppu = &maxnes->nes->ppu;
+    observe_frame(ppu_frame(ppu), ppu_previous_frame(ppu), spec, out);
+    return MAXNES_OK;
+}
+
+int maxnes_batch_set_observation(MaxNESBatch *batch, const MaxNESObservation *spec) {
+    if (!batch || !spec || !valid_observation(spec)) {
+        return MAXNES_ERR_ARGUMENT;
+    }
+    batch->processed = *spec;
+    return MAXNES_OK;
+}
+
+// bytes per instance that maxnes_batch_step writes for an observation type
+size_t maxnes_observation_size(const MaxNESBatch *batch, int observation) {
+    switch (observation) {
+        case MAXNES_OBS_NONE:
+            return 0;
+        case MAXNES_OBS_RAM:
+            return MAXNES_RAM_SIZE;
+        case MAXNES_OBS_FRAME:
+            return MAXNES_SCREEN_WIDTH * MAXNES_SCREEN_HEIGHT;
+        case MAXNES_OBS_PROCESSED:
+            return batch ? batch->processed.width * batch->processed.height : 0;
+    }
+    return 0;
+}
+
+typedef struct BatchStep {
+    MaxNES *const *instances;
+    unsigned frames;
+    const uint8_t *inputs;
+    int observation;
+    const MaxNESObservation *processed;
+    size_t size;
+    uint8_t *observations;
+    int *statuses;
+} BatchStep;
+
+static void step_instance(void *context, unsigned index) {
+    BatchStep *step = (BatchStep*) context;
+    MaxNES *maxnes = step->instances[index];
+    int status = MAXNES_OK;
+
+    for (unsigned f = 0; f < step->frames && status == MAXNES_OK; f++) {
+        maxnes_set_input(maxnes, 0, step->inputs[index * step->frames + f]);
+        status = maxnes_step_frame(maxnes);
+    }
+
+    uint8_t *out = step->observations + index * step->size;
+    if (status == MAXNES_OK && step->observation == MAXNES_OBS_RAM) {
+        memcpy(out, maxnes->nes->ram, step->size);
+    } else if (status == MAXNES_OK && step->observation == MAXNES_OBS_FRAME) {
+        memcpy(out, ppu_frame(&maxnes->nes->ppu), step->size);
+    } else if (status == MAXNES_OK && step->observation == MAXNES_OBS_PROCESSED) {
+        maxnes_observe(maxnes, step->processed, out);
+    }
+    step->statuses[index] = status;
+}
+
+// steps count instances by frames frames each across the batch's threads
+// inputs holds count * frames port 0 button bytes, instance-major
+// observations receives count * maxnes_observation_size(batch, observation) bytes taken after the last frame
+// statuses, if not NULL, receives each instance's result; the first failure is also returned
+// no python objects are touched, so ctypes callers can let it run with the gil released
+int maxnes_batch_step(MaxNESBatch *batch, MaxNES *const *instances, unsigned count, unsigned frames,
+        const uint8_t *inputs, int observation, uint8_t *observations, int *statuses) {
+    if (!batch || !instances || (frames && !inputs) || (maxnes_observation_size(batch, observation) && !observations)) {
+        return MAXNES_ERR_ARGUMENT;
+    }
+    if (observation < MAXNES_OBS_NONE || observation > MAXNES_OBS_PROCESSED) {
+        return MAXNES_ERR_ARGUMENT;
+    }
+    for (unsigned i = 0; i < count; i++) {
+        if (!instances[i] || !instances[i]->nes) {
+            return MAXNES_ERR_NO_ROM;
+        }
+    }
+
+    int *results = statuses ? statuses : (int*) calloc(count, sizeof(int));
+    BatchStep step = {instances, frames, inputs, observation, &batch->processed,
+        maxnes_observation_size(batch, observation), observations, results};
+    run_parallel(batch->pool, count, step_instance, &step);
+
+    int status = MAXNES_OK;
+    for (unsigned i = 0; i < count && status == MAXNES_OK; i++) {
+        status = results[i];
+    }
+    if (!statuses) {
+        free(results);
+    }
+    return status;
+}
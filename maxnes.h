@@ -0,0 +1,102 @@
+#pragma once
+
+// embeddable emulator interface, nothing here terminates the host process
+// every call reporting failure returns a MAXNES_STATUS
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MAXNES_SCREEN_WIDTH 256
+#define MAXNES_SCREEN_HEIGHT 240
+#define MAXNES_RAM_SIZE 2048
+#define MAXNES_PAGE_SIZE 256                // granularity of write tracking, cpu ram is pages 0-7
+
+typedef enum MAXNES_STATUS {
+    MAXNES_OK = 0,
+    MAXNES_ERR_ROM_FORMAT = -1,         // image is not a supported ines file
+    MAXNES_ERR_NO_ROM = -2,             // no rom loaded yet
+    MAXNES_ERR_INVALID_INSTRUCTION = -3,// emulated cpu halted on an instruction it cannot execute
+    MAXNES_ERR_STATE = -4,              // snapshot buffer has the wrong size or comes from another build
+    MAXNES_ERR_ARGUMENT = -5
+} MAXNES_STATUS;
+
+typedef enum MAXNES_OBSERVATION {
+    MAXNES_OBS_NONE = 0,
+    MAXNES_OBS_RAM = 1,                 // MAXNES_RAM_SIZE bytes of cpu ram
+    MAXNES_OBS_FRAME = 2,               // MAXNES_SCREEN_WIDTH * MAXNES_SCREEN_HEIGHT palette indices
+    MAXNES_OBS_PROCESSED = 3            // frame converted per the batch's MaxNESObservation
+} MAXNES_OBSERVATION;
+
+typedef enum MAXNES_PIXEL_FORMAT {
+    MAXNES_FORMAT_GRAY = 0,             // luma, area-averaged when downscaling
+    MAXNES_FORMAT_INDEX = 1             // raw palette indices, nearest sample when downscaling
+} MAXNES_PIXEL_FORMAT;
+
+#define MAXNES_WATCH_READ 1
+#define MAXNES_WATCH_WRITE 2
+#define MAXNES_WATCH_CHANGE 4               // a write storing a different value than the one it replaces
+
+// one cpu access matching a watch, buffered until collected with maxnes_watch_events
+typedef struct MaxNESWatchEvent {
+    uint64_t cycle;
+    uint32_t frame;                     // frame the access happened in
+    uint16_t address;                   // as accessed, ram mirrors are reported as such
+    uint16_t pc;                        // program counter, usually already past the accessing instruction
+    int kinds;                          // MAXNES_WATCH_* kinds the access matched
+    uint8_t old_value;                  // writes only
+    uint8_t value;
+} MaxNESWatchEvent;
+
+// post-frame conversion from the palette-index framebuffer, written straight to the caller buffer
+typedef struct MaxNESObservation {
+    int format;                         // MAXNES_PIXEL_FORMAT
+    unsigned width;                     // output size, at most the cropped size
+    unsigned height;
+    unsigned crop_top;                  // screen rows and columns dropped before scaling
+    unsigned crop_bottom;
+    unsigned crop_left;
+    unsigned crop_right;
+    int max_pool;                       // gray only: per-pixel max of the last two frames, hides flicker
+} MaxNESObservation;
+
+typedef struct MaxNES MaxNES;
+typedef struct MaxNESBatch MaxNESBatch;
+
+MaxNES *maxnes_create(void);
+void maxnes_destroy(MaxNES *maxnes);
+int maxnes_load_rom(MaxNES *maxnes, const uint8_t *data, size_t size);
+int maxnes_reset(MaxNES *maxnes);
+int maxnes_step_frame(MaxNES *maxnes);
+int maxnes_set_input(MaxNES *maxnes, unsigned port, uint8_t buttons);
+const uint8_t *maxnes_get_framebuffer(const MaxNES *maxnes);
+int maxnes_get_emphasis(const MaxNES *maxnes);
+uint64_t maxnes_frame_hash(const MaxNES *maxnes);
+int maxnes_get_rgb(const MaxNES *maxnes, uint32_t *out);
+const uint8_t *maxnes_get_ram(const MaxNES *maxnes);
+size_t maxnes_state_size(void);
+int maxnes_save_state(const MaxNES *maxnes, void *buffer, size_t size);
+int maxnes_load_state(MaxNES *maxnes, const void *buffer, size_t size);
+size_t maxnes_delta_max_size(void);
+int maxnes_save_delta(MaxNES *maxnes, void *buffer, size_t size, size_t *written);
+int maxnes_load_delta(MaxNES *maxnes, const void *buffer, size_t size);
+int maxnes_dirty_pages(const MaxNES *maxnes, uint64_t *bitmap, unsigned words);
+int maxnes_watch(MaxNES *maxnes, uint16_t address, unsigned length, int kinds);
+int maxnes_watch_events(MaxNES *maxnes, MaxNESWatchEvent *events, unsigned capacity, uint64_t *dropped);
+MaxNES *maxnes_clone(const MaxNES *source);
+int maxnes_reserve(MaxNES *maxnes, unsigned count);
+
+MaxNESBatch *maxnes_batch_create(unsigned threads);
+void maxnes_batch_destroy(MaxNESBatch *batch);
+size_t maxnes_observation_size(const MaxNESBatch *batch, int observation);
+int maxnes_batch_set_observation(MaxNESBatch *batch, const MaxNESObservation *spec);
+int maxnes_observe(const MaxNES *maxnes, const MaxNESObservation *spec, uint8_t *out);
+int maxnes_batch_step(MaxNESBatch *batch, MaxNES *const *instances, unsigned count, unsigned frames,
+        const uint8_t *inputs, int observation, uint8_t *observations, int *statuses);
+
+#ifdef __cplusplus
+}
+#endif
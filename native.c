@@ -0,0 +1,286 @@
+#include "native.h"
+#include "idle.h"
+#include <dlfcn.h>
+#include <string.h>
+
+// register an instruction loads, stores or compares
+static const char *inst_reg(const Inst *inst) {
+    switch (inst->inst_type) {
+        case LDX_OP: case STX_OP: case CPX_OP: case INX_OP: case DEX_OP:
+            return "cpu->x_reg";
+        case LDY_OP: case STY_OP: case CPY_OP: case INY_OP: case DEY_OP:
+            return "cpu->y_reg";
+        default:
+            return "cpu->acc_reg";
+    }
+}
+
+static uint16_t operand_addr(const Inst *inst) {
+    return (inst->body[1] << 8) | inst->body[0];
+}
+
+// c expression for an operand read that needs no i/o, NULL when the interpreter has to resolve it
+// rom is immutable, so absolute rom operands are folded to constants
+static const char *plain_operand(const ROM *rom, const Inst *inst, char *expr) {
+    uint16_t addr = operand_addr(inst);
+    switch (inst->addr_mode) {
+        case IMMEDIATE:
+            sprintf(expr, "0x%02x", inst->body[0]);
+            return expr;
+        case ZERO_PAGE:
+            sprintf(expr, "ram[0x%02x]", inst->body[0]);
+            return expr;
+        case ZERO_PAGE_X:
+            sprintf(expr, "ram[(uint8_t) (0x%02x + cpu->x_reg)]", inst->body[0]);
+            return expr;
+        case ABSOLUTE:
+            if (addr <= 0x1fff) {
+                sprintf(expr, "ram[0x%03x]", addr % NES_RAM_SIZE);
+                return expr;
+            } else if (addr >= PRG_ROM_START) {
+                sprintf(expr, "0x%02x", read_prg(rom, addr));
+                return expr;
+            }
+            return NULL;
+        default:
+            return NULL;
+    }
+}
+
+// ram index of a store that only touches ram, NULL when write_mem is needed
+static const char *plain_destination(const Inst *inst, char *expr) {
+    uint16_t addr = operand_addr(inst);
+    switch (inst->addr_mode) {
+        case ZERO_PAGE:
+            sprintf(expr, "0x%02x", inst->body[0]);
+            return expr;
+        case ZERO_PAGE_X:
+            sprintf(expr, "(uint8_t) (0x%02x + cpu->x_reg)", inst->body[0]);
+            return expr;
+        case ZERO_PAGE_Y:
+            sprintf(expr, "(uint8_t) (0x%02x + cpu->y_reg)", inst->body[0]);
+            return expr;
+        case ABSOLUTE:
+            if (addr <= 0x1fff) {
+                sprintf(expr, "0x%03x", addr % NES_RAM_SIZE);
+                return expr;
+            }
+            return NULL;
+        default:
+            return NULL;
+    }
+}
+
+// status bit tested by a branch and the value that takes it
+static void branch_condition(const Inst *inst, char *expr) {
+    switch (inst->inst_type) {
+        case BCC_OP: strcpy(expr, "!(cpu->status_reg & 0x01)"); break;
+        case BCS_OP: strcpy(expr, "cpu->status_reg & 0x01"); break;
+        case BNE_OP: strcpy(expr, "!(cpu->status_reg & 0x02)"); break;
+        case BEQ_OP: strcpy(expr, "cpu->status_reg & 0x02"); break;
+        case BVC_OP: strcpy(expr, "!(cpu->status_reg & 0x40)"); break;
+        case BVS_OP: strcpy(expr, "cpu->status_reg & 0x40"); break;
+        case BPL_OP: strcpy(expr, "!(cpu->status_reg & 0x80)"); break;
+        default: strcpy(expr, "cpu->status_reg & 0x80"); break; // bmi
+    }
+}
+
+// c statement for the instructions that are emitted inline, false when the interpreter runs it
+static bool inline_statement(const ROM *rom, const Inst *inst, char *line) {
+    char operand[64];
+    char destination[64];
+    const char *reg = inst_reg(inst);
+
+    switch (inst->inst_type) {
+        case LDA_OP: case LDX_OP: case LDY_OP:
+            if (!plain_operand(rom, inst, operand)) {
+                return false;
+            }
+            sprintf(line, "native_nz(cpu, %s = %s);", reg, operand);
+            return true;
+        case STA_OP: case STX_OP: case STY_OP:
+            if (!plain_destination(inst, destination)) {
+                return false;
+            }
+            sprintf(line, "ram[%s] = %s; mark_ram_dirty(nes, %s);", destination, reg, destination);
+            return true;
+        case AND_OP: case ORA_OP: case EOR_OP:
+            if (!plain_operand(rom, inst, operand)) {
+                return false;
+            }
+            sprintf(line, "native_nz(cpu, cpu->acc_reg %s= %s);",
+                    inst->inst_type == AND_OP ? "&" : inst->inst_type == ORA_OP ? "|" : "^", operand);
+            return true;
+        case CMP_OP: case CPX_OP: case CPY_OP:
+            if (!plain_operand(rom, inst, operand)) {
+                return false;
+            }
+            sprintf(line, "native_compare(cpu, %s, %s);", reg, operand);
+            return true;
+        case INC_OP: case DEC_OP:
+            if (inst->addr_mode != ZERO_PAGE && inst->addr_mode != ZERO_PAGE_X) {
+                return false;
+            }
+            plain_destination(inst, destination);
+            sprintf(line, "native_nz(cpu, %sram[%s]); mark_ram_dirty(nes, %s);", inst->inst_type == INC_OP ? "++" : "--",
+                    destination, destination);
+            return true;
+        case INX_OP: case INY_OP:
+            sprintf(line, "native_nz(cpu, ++%s);", reg);
+            return true;
+        case DEX_OP: case DEY_OP:
+            sprintf(line, "native_nz(cpu, --%s);", reg);
+            return true;
+        case TAX_OP: strcpy(line, "native_nz(cpu, cpu->x_reg = cpu->acc_reg);"); return true;
+        case TAY_OP: strcpy(line, "native_nz(cpu, cpu->y_reg = cpu->acc_reg);"); return true;
+        case TXA_OP: strcpy(line, "native_nz(cpu, cpu->acc_reg = cpu->x_reg);"); return true;
+        case TYA_OP: strcpy(line, "native_nz(cpu, cpu->acc_reg = cpu->y_reg);"); return true;
+        case TSX_OP: strcpy(line, "native_nz(cpu, cpu->x_reg = cpu->stack_p);"); return true;
+        case TXS_OP: strcpy(line, "cpu->stack_p = cpu->x_reg;"); return true;
+        case CLC_OP: strcpy(line, "cpu->status_reg &= ~0x01;"); return true;
+        case SEC_OP: strcpy(line, "cpu->status_reg |= 0x01;"); return true;
+        case CLI_OP: strcpy(line, "cpu->status_reg &= ~0x04;"); return true;
+        case SEI_OP: strcpy(line, "cpu->status_reg |= 0x04;"); return true;
+        case CLD_OP: strcpy(line, "cpu->status_reg &= ~0x08;"); return true;
+        case SED_OP: strcpy(line, "cpu->status_reg |= 0x08;"); return true;
+        case CLV_OP: strcpy(line, "cpu->status_reg &= ~0x40;"); return true;
+        case NOP: strcpy(line, ";"); return inst->size_bytes == 1;
+        default:
+            return false;
+    }
+}
+
+// emits one instruction, returns whether it ended the block
+static bool emit_inst(FILE *out, const ROM *rom, uint16_t addr, bool block_end) {
+    unsigned offset = prg_offset(rom, addr);
+    const Inst *inst = &rom->prg_inst[offset];
+    uint16_t next = addr + inst->size_bytes;
+    char line[160];
+
+    fprintf(out, "    // %04x: %s\n", addr, inst_names[inst->inst_type]);
+    if (inst->addr_mode == RELATIVE) {
+        uint16_t target = next + (int8_t) inst->body[0];
+        unsigned taken = inst->branch_succeeds_cycles + (page_crossed(next, target) ? inst->page_cross_cycles : 0);
+        branch_condition(inst, line);
+        fprintf(out, "    cpu->cycles += %u; cpu->insts++;\n", inst->cycles);
+        fprintf(out, "    if (%s) { cpu->program_c = 0x%04x; cpu->cycles += %u; return true; }\n", line, target, taken);
+        fprintf(out, "    cpu->program_c = 0x%04x;\n    return true;\n", next);
+        return true;
+    }
+    if (inst->inst_type == JMP_OP && inst->addr_mode == ABSOLUTE) {
+        fprintf(out, "    cpu->cycles += %u; cpu->insts++;\n", inst->cycles);
+        fprintf(out, "    cpu->program_c = 0x%04x;\n    return true;\n", operand_addr(inst));
+        return true;
+    }
+
+    if (inline_statement(rom, inst, line)) {
+        fprintf(out, "    %s\n    cpu->cycles += %u; cpu->insts++;\n", line, inst->cycles);
+        if (block_end) {
+            fprintf(out, "    cpu->program_c = 0x%04x;\n    return true;\n", next);
+        }
+        return block_end;
+    }
+
+    // anything touching i/o, the stack or indexed memory goes through the interpreter's own handler
+    fprintf(out, "    cpu->program_c = 0x%04x;\n", next);
+    fprintf(out, "    exec_inst(nes, &nes->rom->prg_inst[0x%04x]);\n", offset);
+    if (block_end) {
+        fprintf(out, "    return nes->status == NES_OK;\n");
+        return true;
+    }
+    fprintf(out, "    if (nes->batch_end <= cpu->cycles || nes->status != NES_OK) {\n        return false;\n    }\n");
+    return false;
+}
+
+// writes c source with one function per analyzed basic block, to be built into a plugin with
+//   gcc -O2 -shared -fPIC -I<maxnes source> rom.c -o rom.so
+bool emit_native_source(const ROM *rom, const Analysis *analysis, FILE *out) {
+    fprintf(out, "// generated by maxnes from rom %016llx, do not edit\n", (unsigned long long) analysis->rom_hash);
+    fprintf(out, "#include \"native.h\"\n\n");
+
+    for (unsigned b = 0; b < analysis->block_count; b++) {
+        const Block *block = &analysis->blocks[b];
+        fprintf(out, "static bool block_%04x(NES *nes) {\n", block->start);
+        fprintf(out, "    CPU *cpu = &nes->cpu;\n    uint8_t *ram = nes->ram;\n    (void) ram;\n");
+        uint16_t addr = block->start;
+        for (unsigned i = 0; i < block->insts; i++) {
+            const Inst *inst = &rom->prg_inst[prg_offset(rom, addr)];
+            if (emit_inst(out, rom, addr, i + 1 == block->insts)) {
+                break;
+            }
+            addr += inst->size_bytes;
+        }
+        fprintf(out, "}\n\n");
+    }
+
+    fprintf(out, "static const NativeBlock blocks[] = {\n");
+    for (unsigned b = 0; b < analysis->block_count; b++) {
+        const Block *block = &analysis->blocks[b];
+        uint16_t last = block->start;
+        for (unsigned i = 0; i + 1 < block->insts; i++) {
+            last += rom->prg_inst[prg_offset(rom, last)].size_bytes;
+        }
+        fprintf(out, "    {0x%04x, 0x%04x, %u, block_%04x},\n", block->start, last, block->max_cycles, block->start);
+    }
+    fprintf(out, "};\n\n");
+    fprintf(out, "const NativeModule %s = {%u, 0x%016llxull, %u, blocks};\n", NATIVE_MODULE_SYMBOL,
+            NATIVE_ABI_VERSION, (unsigned long long) analysis->rom_hash, analysis->block_count);
+    return !ferror(out);
+}
+
+// maps a plugin built from emit_native_source onto the rom, refusing one built for other contents
+bool load_native(ROM *rom, const char *path) {
+    if (rom->cycle_stepped) { // recompiled blocks access memory at instruction granularity
+        fprintf(stderr, "Error: rom needs the cycle-stepped core, native plugin not loaded\n");
+        return false;
+    }
+    void *plugin = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (plugin == NULL) {
+        fprintf(stderr, "Error: %s\n", dlerror());
+        return false;
+    }
+
+    const NativeModule *module = (const NativeModule*) dlsym(plugin, NATIVE_MODULE_SYMBOL);
+    if (module == NULL || module->abi_version != NATIVE_ABI_VERSION || module->rom_hash != rom_hash(rom)) {
+        fprintf(stderr, "Error: native plugin does not match rom\n");
+        dlclose(plugin);
+        return false;
+    }
+
+    unload_native(rom);
+    rom->native = (const NativeBlock**) calloc(rom->prg_len, sizeof(NativeBlock*));
+    for (unsigned i = 0; i < module->block_count; i++) {
+        rom->native[prg_offset(rom, module->blocks[i].addr)] = &module->blocks[i];
+    }
+    rom->native_plugin = plugin;
+    return true;
+}
+
+// replicas own a copy of the block table but not the plugin
+void unload_native(ROM *rom) {
+    free(rom->native);
+    if (rom->native_plugin) {
+        dlclose(rom->native_plugin);
+    }
+    rom->native = NULL;
+    rom->native_plugin = NULL;
+}
+
+// runs the recompiled block at the program counter if there is one and it surely ends before the batch does,
+// returns false to let the interpreter take the instruction
+bool run_native_block(NES *nes) {
+    const ROM *rom = nes->rom;
+    CPU *cpu = &nes->cpu;
+    if (!rom->native || cpu->program_c < PRG_ROM_START || (nes->watches && nes->watches->ram_pages)) {
+        return false; // blocks access ram directly, bypassing watches
+    }
+    const NativeBlock *block = rom->native[prg_offset(rom, cpu->program_c)];
+    if (!block || block->addr != cpu->program_c || cpu->cycles + block->max_cycles >= nes->batch_end) {
+        return false;
+    }
+
+    if (block->run(nes) && cpu->program_c <= block->last) { // closing backward jump, possibly an idle loop
+        fast_forward_idle_loop(nes, block->last);
+    }
+    return true;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "nes.h"
+#include "analysis.h"
+
+#define NATIVE_ABI_VERSION 6
+#define NATIVE_MODULE_SYMBOL "maxnes_native_module"
+
+// runs a recompiled block from its first instruction, returns whether it ran to its end rather than
+// stopping early because an i/o access moved the next event or halted the console
+typedef bool (*NativeBlockFn)(NES *nes);
+
+typedef struct NativeBlock {
+    uint16_t addr;          // cpu address of first instruction
+    uint16_t last;          // cpu address of last instruction
+    uint16_t max_cycles;    // only entered when this many cycles fit before the batch ends
+    NativeBlockFn run;
+} NativeBlock;
+
+// the one symbol a recompiled plugin exports
+typedef struct NativeModule {
+    uint32_t abi_version;
+    uint64_t rom_hash;
+    unsigned block_count;
+    const NativeBlock *blocks;
+} NativeModule;
+
+bool emit_native_source(const ROM *rom, const Analysis *analysis, FILE *out);
+bool load_native(ROM *rom, const char *path);
+void unload_native(ROM *rom);
+bool run_native_block(NES *nes);
+
+// zero and negative flags, shared with generated code
+static inline void native_nz(CPU *cpu, uint8_t value) {
+    cpu->status_reg = (cpu->status_reg & 0x7d) | (value & 0x80) | (value ? 0 : 0x02);
+}
+
+// carry, zero and negative of a register compare
+static inline void native_compare(CPU *cpu, uint8_t reg, uint8_t value) {
+    cpu->status_reg = (cpu->status_reg & 0x7c) | ((uint8_t) (reg - value) & 0x80) | (reg == value ? 0x02 : 0) | (reg >= value);
+}
@@ -1,18 +1,331 @@
 #include "nes.h"
+#include "native.h"
 #include <stdlib.h>
+#include <string.h>
 
-NES *new_NES() {
-    NES *nes = (NES*) calloc(1, sizeof(NES));
-    nes->cpu = new_CPU();
-    nes->ram = (uint8_t*) calloc(NES_RAM_SIZE, sizeof(uint8_t));
-    nes->rom = (ROM*) calloc(1, sizeof(ROM));
+// the whole console is one zeroed allocation
+NES *new_NES(const ROM *rom) {
+    NES *nes = (NES*) aligned_alloc(NES_ALIGN, sizeof(NES)); // sizeof is a multiple of the alignment
+    memset(nes, 0, sizeof(NES));
+    nes->rom = rom;
+    power_on_cpu(&nes->cpu);
 
+    reset_nes(nes);
     return nes;
 }
 
 void delete_nes(NES *nes) {
-    free(nes->cpu);
-    free(nes->ram);
-    close_rom(nes->rom);
+    delete_watches(nes->watches);
     free(nes);
 }
+
+// restarts the console, component clocks are set relative to the current cycle count
+void reset_nes(NES *nes) {
+    reset_scheduler(&nes->scheduler);
+    nes->nmi_pending = false;
+    nes->irq_lines = 0;
+    nes->status = NES_OK;
+
+    reset_cpu(nes);
+    nes->ppu.in_vblank = false;
+    schedule_component(nes, COMPONENT_PPU, ppu_dot_cycle(nes->ppu.frame, PPU_VBLANK_SCANLINE, 1));
+    apu_write_frame_counter(nes, 0);
+}
+
+// sets when a component next resumes, cutting the current batch short if that is sooner
+void schedule_component(NES *nes, COMPONENT component, uint64_t time) {
+    nes->scheduler.clocks[component] = time;
+    if (time < nes->batch_end) {
+        nes->batch_end = time;
+    }
+}
+
+// stops execution at the current instruction boundary, run functions return until status is cleared
+void halt_nes(NES *nes, NES_STATUS status) {
+    nes->status = status;
+    nes->batch_end = 0;
+}
+
+void raise_nmi(NES *nes) {
+    nes->nmi_pending = true;
+    nes->batch_end = 0; // service at next instruction boundary
+}
+
+// copies a cpu page into sprite memory starting at oam_addr, stalling the cpu for the duration,
+// ram and rom pages are copied in bulk and only register pages are read byte by byte
+static void oam_dma(NES *nes) {
+    ppu_catch_up(nes); // scanlines already passed keep the old sprites
+    const uint8_t *page = direct_page(nes, nes->dma_page);
+    uint8_t start = nes->ppu.oam_addr;
+    if (page && !(nes->watches && nes->watches->pages[nes->dma_page])) { // watched pages see every dma read
+        memcpy(&nes->ppu.oam[start], page, OAM_SIZE - start);
+        memcpy(nes->ppu.oam, page + OAM_SIZE - start, start); // wraps around sprite memory
+    } else {
+        uint16_t base = nes->dma_page << 8;
+        for (unsigned i = 0; i < OAM_SIZE; i++) {
+            nes->ppu.oam[(uint8_t) (start + i)] = read_mem(nes, base + i);
+        }
+    }
+    mark_ppu_dirty(nes, nes->ppu.oam);
+    nes->cpu.cycles += 513 + (nes->cpu.cycles & 1); // extra alignment cycle on odd cycles
+}
+
+// runs a component's state machine up to its next synchronization point, returning that point's cycle
+static uint64_t resume_component(NES *nes, COMPONENT component, uint64_t time) {
+    switch (component) {
+        case COMPONENT_PPU:
+            return resume_ppu(nes);
+        case COMPONENT_APU:
+            return apu_frame_irq(nes, time);
+        case COMPONENT_DMA:
+            oam_dma(nes);
+            return NO_EVENT; // dormant until the next $4014 write
+        case COMPONENT_COUNT:
+            break;
+    }
+    return NO_EVENT;
+}
+
+// catches every component up with the cpu, always resuming the one furthest behind so that their
+// actions interleave in master clock order
+void sync_components(NES *nes) {
+    for (;;) {
+        COMPONENT component = furthest_behind(&nes->scheduler);
+        uint64_t time = nes->scheduler.clocks[component];
+        if (time > nes->cpu.cycles) {
+            return;
+        }
+        nes->idle.tracking = false; // state a waiting loop observes may have changed
+        nes->scheduler.clocks[component] = resume_component(nes, component, time);
+    }
+}
+
+static void service_interrupts(NES *nes) {
+    if (nes->nmi_pending) {
+        nes->nmi_pending = false;
+        nes->idle.tracking = false;
+        cpu_interrupt(nes, NMI_VECTOR);
+    } else if (nes->irq_lines && !get_cpu_status_bit(&nes->cpu, IRQ_DISABLE)) {
+        nes->idle.tracking = false;
+        cpu_interrupt(nes, IRQ_VECTOR);
+    }
+}
+
+// services pending interrupts and lets the cpu run until the component furthest behind must resume,
+// expects components to have been synced
+void begin_batch(NES *nes, uint64_t until) {
+    service_interrupts(nes);
+
+    nes->batch_end = next_sync_time(&nes->scheduler);
+    if (nes->batch_end > until) {
+        nes->batch_end = until;
+    }
+    if (nes->irq_lines) { // poll irq after every instruction while one is asserted
+        nes->batch_end = nes->cpu.cycles + 1;
+    }
+}
+
+// runs the console until the cpu cycle counter reaches until
+// the cpu executes uninterrupted batches of instructions up to the next component resume, idle loops
+// inside a batch are skipped straight to its end
+void run_nes(NES *nes, uint64_t until) {
+    while (nes->cpu.cycles < until && nes->status == NES_OK) {
+        sync_components(nes);
+        begin_batch(nes, until);
+
+        while (nes->cpu.cycles < nes->batch_end) {
+            if (run_native_block(nes)) {
+                continue;
+            }
+            uint16_t pc = nes->cpu.program_c;
+            step_cpu(nes);
+            if (nes->cpu.program_c <= pc) { // backward jump, possibly a loop waiting for an event
+                fast_forward_idle_loop(nes, pc);
+            }
+        }
+    }
+    sync_components(nes);
+}
+
+// runs a single instruction, entering a pending interrupt's handler first, for debuggers
+void step_nes(NES *nes) {
+    sync_components(nes);
+    begin_batch(nes, nes->cpu.cycles + 1);
+    step_cpu(nes);
+    sync_components(nes);
+}
+
+// cycle at which the current frame's picture is complete
+uint64_t frame_end_cycle(const NES *nes) {
+    return ppu_dot_cycle(nes->ppu.frame, PPU_VBLANK_SCANLINE, 1);
+}
+
+// runs until the ppu finishes the current frame and enters vblank
+void run_frame(NES *nes) {
+    start_dirty_frame(nes);
+    uint32_t frame = nes->ppu.frame;
+    while (nes->ppu.frame == frame && nes->status == NES_OK) {
+        run_nes(nes, frame_end_cycle(nes));
+    }
+}
+
+#define NES_STATE_MAGIC 0x5453584d // "MXST"
+#define NES_STATE_VERSION 4
+
+// snapshot layout: header, then the console state block copied verbatim
+typedef struct NESStateHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+} NESStateHeader;
+
+size_t nes_state_size() {
+    return sizeof(NESStateHeader) + NES_STATE_END - NES_STATE_START;
+}
+
+// writes nes_state_size() bytes describing everything except the shared rom
+void save_nes_state(const NES *nes, uint8_t *state) {
+    NESStateHeader header = {NES_STATE_MAGIC, NES_STATE_VERSION, nes_state_size()};
+    memcpy(state, &header, sizeof(header));
+    memcpy(state + sizeof(header), (const uint8_t*) nes + NES_STATE_START, NES_STATE_END - NES_STATE_START);
+}
+
+// restores a snapshot taken by save_nes_state, returns false if it was made by an incompatible build
+bool load_nes_state(NES *nes, const uint8_t *state) {
+    NESStateHeader header;
+    memcpy(&header, state, sizeof(header));
+    if (header.magic != NES_STATE_MAGIC || header.version != NES_STATE_VERSION || header.size != nes_state_size()) {
+        return false;
+    }
+
+    memcpy((uint8_t*) nes + NES_STATE_START, state + sizeof(header), NES_STATE_END - NES_STATE_START);
+
+    memset(nes->frame_dirty, 0xff, sizeof(nes->frame_dirty)); // everything may differ from before
+    memset(nes->checkpoint_dirty, 0xff, sizeof(nes->checkpoint_dirty));
+    nes->idle.tracking = false;
+    nes->batch_end = 0;
+    nes->status = NES_OK;
+    return true;
+}
+
+_Static_assert((offsetof(PPU, framebuffers) - offsetof(PPU, oam)) % DIRTY_PAGE_SIZE == 0,
+        "framebuffer rows must be whole tracked pages");
+
+#define NES_DELTA_MAGIC 0x4c44584d // "MXDL"
+
+// incremental snapshot layout: header, the untracked state, then each page set in dirty in order
+typedef struct NESDeltaHeader {
+    uint32_t magic;
+    uint32_t version;       // NES_STATE_VERSION, deltas share the state layout
+    uint32_t size;          // of the whole delta
+    uint32_t pages;
+    uint64_t dirty[DIRTY_WORDS];
+} NESDeltaHeader;
+
+// console state outside the tracked pages, registers and bookkeeping small enough to always include
+static const struct {
+    size_t start;
+    size_t end;
+} untracked[] = {
+    {NES_STATE_START, offsetof(NES, ram)},
+    {offsetof(NES, ram) + NES_RAM_SIZE, offsetof(NES, ppu.oam)},
+    {offsetof(NES, ppu.palette) + PALETTE_RAM_SIZE, NES_STATE_END}
+};
+
+#define UNTRACKED_RANGES (sizeof(untracked) / sizeof(untracked[0]))
+
+static uint8_t *tracked_page(NES *nes, unsigned page, size_t *size) {
+    if (page < DIRTY_RAM_PAGES) {
+        *size = DIRTY_PAGE_SIZE;
+        return &nes->ram[page * DIRTY_PAGE_SIZE];
+    }
+    size_t offset = (size_t) (page - DIRTY_RAM_PAGES) * DIRTY_PAGE_SIZE;
+    *size = DIRTY_PPU_BYTES - offset < DIRTY_PAGE_SIZE ? DIRTY_PPU_BYTES - offset : DIRTY_PAGE_SIZE; // palette page is short
+    return (uint8_t*) &nes->ppu + offsetof(PPU, oam) + offset;
+}
+
+static bool page_set(const uint64_t *bitmap, unsigned page) {
+    return bitmap[page / 64] >> (page % 64) & 1;
+}
+
+// clears the per-frame write record, called as each frame starts
+void start_dirty_frame(NES *nes) {
+    memset(nes->frame_dirty, 0, sizeof(nes->frame_dirty));
+}
+
+size_t nes_delta_max_size() {
+    size_t size = sizeof(NESDeltaHeader) + DIRTY_RAM_PAGES * DIRTY_PAGE_SIZE + DIRTY_PPU_BYTES;
+    for (unsigned i = 0; i < UNTRACKED_RANGES; i++) {
+        size += untracked[i].end - untracked[i].start;
+    }
+    return size;
+}
+
+// writes an incremental snapshot of at most nes_delta_max_size() bytes holding only the pages written since
+// the previous one, returns its size; a chain of deltas starts from a freshly created console, and the first
+// delta after load_nes_state holds every page
+size_t save_nes_delta(NES *nes, uint8_t *delta) {
+    NESDeltaHeader header = {NES_DELTA_MAGIC, NES_STATE_VERSION, 0, 0, {0}};
+    memcpy(header.dirty, nes->checkpoint_dirty, sizeof(header.dirty));
+    size_t size = sizeof(header);
+    for (unsigned i = 0; i < UNTRACKED_RANGES; i++) {
+        memcpy(delta + size, (const uint8_t*) nes + untracked[i].start, untracked[i].end - untracked[i].start);
+        size += untracked[i].end - untracked[i].start;
+    }
+    for (unsigned page = 0; page < DIRTY_PAGES; page++) {
+        if (page_set(header.dirty, page)) {
+            size_t page_size;
+            const uint8_t *source = tracked_page(nes, page, &page_size);
+            memcpy(delta + size, source, page_size);
+            size += page_size;
+            header.pages++;
+        }
+    }
+
+    header.size = size;
+    memcpy(delta, &header, sizeof(header));
+    memset(nes->checkpoint_dirty, 0, sizeof(nes->checkpoint_dirty));
+    return size;
+}
+
+// applies a delta on top of the state the previous delta of its chain produced, returns false if it is
+// malformed or made by an incompatible build
+bool load_nes_delta(NES *nes, const uint8_t *delta, size_t size) {
+    NESDeltaHeader header;
+    if (size < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, delta, sizeof(header));
+    size_t expected = sizeof(header);
+    for (unsigned i = 0; i < UNTRACKED_RANGES; i++) {
+        expected += untracked[i].end - untracked[i].start;
+    }
+    for (unsigned page = 0; page < DIRTY_PAGES; page++) {
+        size_t page_size;
+        tracked_page(nes, page, &page_size);
+        expected += page_set(header.dirty, page) ? page_size : 0;
+    }
+    if (header.magic != NES_DELTA_MAGIC || header.version != NES_STATE_VERSION || header.size != size || expected != size) {
+        return false;
+    }
+
+    size_t offset = sizeof(header);
+    for (unsigned i = 0; i < UNTRACKED_RANGES; i++) {
+        memcpy((uint8_t*) nes + untracked[i].start, delta + offset, untracked[i].end - untracked[i].start);
+        offset += untracked[i].end - untracked[i].start;
+    }
+    for (unsigned page = 0; page < DIRTY_PAGES; page++) {
+        if (page_set(header.dirty, page)) {
+            size_t page_size;
+            uint8_t *destination = tracked_page(nes, page, &page_size);
+            memcpy(destination, delta + offset, page_size);
+            offset += page_size;
+            mark_dirty(nes, page);
+        }
+    }
+
+    nes->idle.tracking = false;
+    nes->batch_end = 0;
+    nes->status = NES_OK;
+    return true;
+}
@@ -1,19 +1,95 @@
 #pragma once
 
 #include "cpu.h"
+#include "ppu.h"
+#include "apu.h"
 #include "rom.h"
 #include "ram.h"
+#include "scheduler.h"
+#include "idle.h"
+#include "controller.h"
+#include "watch.h"
+#include <stddef.h>
 
 typedef struct CPU CPU;
 typedef struct ROM ROM;
 
+typedef enum NES_STATUS {
+    NES_OK,
+    NES_INVALID_INSTRUCTION,    // decoded instruction has no handler, execution halted
+    NES_DEBUG_STOP              // a debugger breakpoint or watchpoint was hit
+} NES_STATUS;
+
+typedef enum IRQ_SOURCE {
+    IRQ_APU_FRAME = 1 << 0
+} IRQ_SOURCE;
+
+#define NES_ALIGN 64
+
+// writes to cpu ram and to ppu memory from oam through the palette are tracked per page,
+// ram pages come first, then that ppu block page by page
+#define DIRTY_PAGE_SIZE 256
+#define DIRTY_RAM_PAGES (NES_RAM_SIZE / DIRTY_PAGE_SIZE)
+#define DIRTY_PPU_BYTES (offsetof(PPU, palette) + PALETTE_RAM_SIZE - offsetof(PPU, oam))
+#define DIRTY_PAGES (DIRTY_RAM_PAGES + (DIRTY_PPU_BYTES + DIRTY_PAGE_SIZE - 1) / DIRTY_PAGE_SIZE)
+#define DIRTY_WORDS ((DIRTY_PAGES + 63) / 64)
+
+// one contiguous, cache-line-aligned block holding the whole machine, only the rom sits behind a pointer
+// the fields from cpu up to idle are the console state and are snapshotted with a single copy
 typedef struct NES {
-        CPU *cpu;
-        //PPU *ppu;
-        //APU *apu;
-        uint8_t *ram;
-        ROM *rom;
+        const ROM *rom;         // shared, not owned by the NES
+        uint64_t batch_end;     // cycle at which the current run of instructions must stop
+        NES_STATUS status;      // execution stops once this leaves NES_OK
+        uint64_t frame_dirty[DIRTY_WORDS];      // pages written since the current frame began
+        uint64_t checkpoint_dirty[DIRTY_WORDS]; // pages written since the last incremental snapshot
+        Watches *watches;       // host-side watchpoints, NULL while nothing is watched
+        _Alignas(NES_ALIGN) CPU cpu;
+        uint8_t ram[NES_RAM_SIZE];
+        Scheduler scheduler;    // clocks of the components running alongside the cpu
+        bool nmi_pending;       // edge-triggered nmi waiting to be serviced
+        uint8_t irq_lines;      // level-triggered irq sources currently asserted
+        uint8_t dma_page;       // source page of pending oam dma
+        Controller controllers[2];
+        bool strobe;            // controllers continuously reload while set
+        APU apu;
+        PPU ppu;                // framebuffers near the end, only written as scanlines are drawn
+        IdleLoop idle;          // busy-wait loop detection, host-side bookkeeping
 } NES;
 
-NES *new_NES();
+#define NES_STATE_START offsetof(NES, cpu)
+#define NES_STATE_END offsetof(NES, idle)
+
+static inline void mark_dirty(NES *nes, unsigned page) {
+    nes->frame_dirty[page / 64] |= 1ull << (page % 64);
+    nes->checkpoint_dirty[page / 64] |= 1ull << (page % 64);
+}
+
+// offset is into cpu ram
+static inline void mark_ram_dirty(NES *nes, unsigned offset) {
+    mark_dirty(nes, offset / DIRTY_PAGE_SIZE);
+}
+
+// byte lies in the tracked ppu block
+static inline void mark_ppu_dirty(NES *nes, const uint8_t *byte) {
+    mark_dirty(nes, DIRTY_RAM_PAGES + (byte - ((const uint8_t*) &nes->ppu + offsetof(PPU, oam))) / DIRTY_PAGE_SIZE);
+}
+
+NES *new_NES(const ROM *rom);
 void delete_nes(NES *nes);
+void reset_nes(NES *nes);
+void schedule_component(NES *nes, COMPONENT component, uint64_t time);
+void raise_nmi(NES *nes);
+void halt_nes(NES *nes, NES_STATUS status);
+void sync_components(NES *nes);
+void begin_batch(NES *nes, uint64_t until);
+void run_nes(NES *nes, uint64_t until);
+void step_nes(NES *nes);
+uint64_t frame_end_cycle(const NES *nes);
+void run_frame(NES *nes);
+size_t nes_state_size();
+void save_nes_state(const NES *nes, uint8_t *state);
+bool load_nes_state(NES *nes, const uint8_t *state);
+void start_dirty_frame(NES *nes);
+size_t nes_delta_max_size();
+size_t save_nes_delta(NES *nes, uint8_t *delta);
+bool load_nes_delta(NES *nes, const uint8_t *delta, size_t size);
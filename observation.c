@@ -0,0 +1,100 @@
+#include "observation.h"
+#include "palette.h"
+#include "ppu.h"
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+bool valid_observation(const MaxNESObservation *spec) {
+    if (spec->crop_left + spec->crop_right >= SCREEN_WIDTH || spec->crop_top + spec->crop_bottom >= SCREEN_HEIGHT) {
+        return false;
+    }
+    unsigned width = SCREEN_WIDTH - spec->crop_left - spec->crop_right;
+    unsigned height = SCREEN_HEIGHT - spec->crop_top - spec->crop_bottom;
+    return spec->width && spec->height && spec->width <= width && spec->height <= height &&
+        (spec->format == MAXNES_FORMAT_GRAY || spec->format == MAXNES_FORMAT_INDEX);
+}
+
+void max_pool_bytes(const uint8_t *a, const uint8_t *b, unsigned count, uint8_t *out) {
+    unsigned i = 0;
+#ifdef __SSE2__
+    for (; i + 16 <= count; i += 16) {
+        __m128i max = _mm_max_epu8(_mm_loadu_si128((const __m128i*) (a + i)), _mm_loadu_si128((const __m128i*) (b + i)));
+        _mm_storeu_si128((__m128i*) (out + i), max);
+    }
+#endif
+    for (; i < count; i++) {
+        out[i] = a[i] > b[i] ? a[i] : b[i];
+    }
+}
+
+// adds a row of bytes into 16-bit column sums
+static void accumulate_row(const uint8_t *row, unsigned count, uint16_t *sums) {
+    unsigned i = 0;
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= count; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i*) (row + i));
+        __m128i *lo = (__m128i*) (sums + i);
+        __m128i *hi = (__m128i*) (sums + i + 8);
+        _mm_storeu_si128(lo, _mm_add_epi16(_mm_loadu_si128(lo), _mm_unpacklo_epi8(bytes, zero)));
+        _mm_storeu_si128(hi, _mm_add_epi16(_mm_loadu_si128(hi), _mm_unpackhi_epi8(bytes, zero)));
+    }
+#endif
+    for (; i < count; i++) {
+        sums[i] += row[i];
+    }
+}
+
+// gray conversion with area downscale, one output row at a time
+static void observe_gray(const uint8_t *frame, const uint8_t *previous, const MaxNESObservation *spec,
+        unsigned width, unsigned height, uint8_t *out) {
+    uint8_t gray[SCREEN_WIDTH];
+    uint8_t previous_gray[SCREEN_WIDTH];
+    uint16_t sums[SCREEN_WIDTH];
+
+    for (unsigned oy = 0; oy < spec->height; oy++) {
+        unsigned y0 = oy * height / spec->height;
+        unsigned y1 = (oy + 1) * height / spec->height; // box of source rows, never empty since output is smaller
+        memset(sums, 0, sizeof(sums));
+        for (unsigned y = y0; y < y1; y++) {
+            const uint8_t *row = frame + (spec->crop_top + y) * SCREEN_WIDTH + spec->crop_left;
+            palette_to_gray(row, width, gray);
+            if (spec->max_pool && previous) {
+                palette_to_gray(previous + (row - frame), width, previous_gray);
+                max_pool_bytes(gray, previous_gray, width, gray);
+            }
+            accumulate_row(gray, width, sums);
+        }
+
+        for (unsigned ox = 0; ox < spec->width; ox++) {
+            unsigned x0 = ox * width / spec->width;
+            unsigned x1 = (ox + 1) * width / spec->width;
+            unsigned total = 0;
+            for (unsigned x = x0; x < x1; x++) {
+                total += sums[x];
+            }
+            unsigned area = (x1 - x0) * (y1 - y0);
+            out[oy * spec->width + ox] = (total + area / 2) / area;
+        }
+    }
+}
+
+// writes spec->width * spec->height bytes to out, previous may be NULL when not max pooling
+void observe_frame(const uint8_t *frame, const uint8_t *previous, const MaxNESObservation *spec, uint8_t *out) {
+    unsigned width = SCREEN_WIDTH - spec->crop_left - spec->crop_right;
+    unsigned height = SCREEN_HEIGHT - spec->crop_top - spec->crop_bottom;
+
+    if (spec->format == MAXNES_FORMAT_GRAY) {
+        observe_gray(frame, previous, spec, width, height, out);
+        return;
+    }
+
+    for (unsigned oy = 0; oy < spec->height; oy++) { // palette indices cannot be averaged, sample box centers
+        const uint8_t *row = frame + (spec->crop_top + (2 * oy + 1) * height / (2 * spec->height)) * SCREEN_WIDTH + spec->crop_left;
+        for (unsigned ox = 0; ox < spec->width; ox++) {
+            out[oy * spec->width + ox] = row[(2 * ox + 1) * width / (2 * spec->width)];
+        }
+    }
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "maxnes.h"
+
+bool valid_observation(const MaxNESObservation *spec);
+void observe_frame(const uint8_t *frame, const uint8_t *previous, const MaxNESObservation *spec, uint8_t *out);
+void max_pool_bytes(const uint8_t *a, const uint8_t *b, unsigned count, uint8_t *out);
@@ -0,0 +1,166 @@
+#include "palette.h"
+#include <stdbool.h>
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <tmmintrin.h>
+#define SSSE3_KERNELS // built whatever the compiler baseline, used only where the cpu supports them
+#endif
+
+const uint32_t nes_palette_rgb[PALETTE_COLORS] = {
+    0x666666, 0x002a88, 0x1412a7, 0x3b00a4, 0x5c007e, 0x6e0040, 0x6c0600, 0x561d00,
+    0x333500, 0x0b4800, 0x005200, 0x004f08, 0x00404d, 0x000000, 0x000000, 0x000000,
+    0xadadad, 0x155fd9, 0x4240ff, 0x7527fe, 0xa01acc, 0xb71e7b, 0xb53120, 0x994e00,
+    0x6b6d00, 0x388700, 0x0c9300, 0x008f32, 0x007c8d, 0x000000, 0x000000, 0x000000,
+    0xfffeff, 0x64b0ff, 0x9290ff, 0xc676ff, 0xf36aff, 0xfe6ecc, 0xfe8170, 0xea9e22,
+    0xbcbe00, 0x88d800, 0x5ce430, 0x45e082, 0x48cdde, 0x4f4f4f, 0x000000, 0x000000,
+    0xfffeff, 0xc0dfff, 0xd3d2ff, 0xe8c8ff, 0xfbc2ff, 0xfec4ea, 0xfeccc5, 0xf7d8a5,
+    0xe4e594, 0xcfef96, 0xbdf4ab, 0xb3f3cc, 0xb5ebf2, 0xb8b8b8, 0x000000, 0x000000
+};
+
+// rec. 601 luma of a color index, palette ram only holds 6-bit indices
+uint8_t palette_luma(uint8_t index) {
+    uint32_t rgb = nes_palette_rgb[index % PALETTE_COLORS];
+    unsigned r = (rgb >> 16) & 0xff;
+    unsigned g = (rgb >> 8) & 0xff;
+    unsigned b = rgb & 0xff;
+    return (299 * r + 587 * g + 114 * b + 500) / 1000;
+}
+
+static uint32_t rgb_table[PALETTE_ENTRIES]; // emphasis << 6 | index
+static uint8_t luma_table[PALETTE_COLORS];
+static bool palette_ssse3; // conversions take the shuffle kernels
+static pthread_once_t palette_once = PTHREAD_ONCE_INIT;
+
+// each emphasis bit (red, green, blue) dims the other two channels
+static void fill_rgb_table() {
+    for (unsigned entry = 0; entry < PALETTE_ENTRIES; entry++) {
+        uint32_t rgb = nes_palette_rgb[entry % PALETTE_COLORS];
+        unsigned emphasis = entry / PALETTE_COLORS;
+        unsigned channels[3] = {(rgb >> 16) & 0xff, (rgb >> 8) & 0xff, rgb & 0xff};
+        if ((entry & 0x0e) != 0x0e) { // the black columns ignore emphasis
+            for (unsigned c = 0; c < 3; c++) {
+                for (unsigned bit = 0; bit < 3; bit++) {
+                    if ((emphasis >> bit) & 1 && bit != c) {
+                        channels[c] = channels[c] * 816 / 1000;
+                    }
+                }
+            }
+        }
+        rgb_table[entry] = channels[0] << 16 | channels[1] << 8 | channels[2];
+    }
+}
+
+#ifdef SSSE3_KERNELS
+// emphasis is fixed per frame, so the 64 colors in play split into three channel tables of 64 bytes
+// that byte shuffles can index directly, 16 pixels at a time with no gathers; returns pixels converted
+__attribute__((target("ssse3")))
+static unsigned palette_to_rgb_ssse3(const uint8_t *indices, unsigned count, const uint32_t *table, uint32_t *rgb) {
+    uint8_t channels[3][PALETTE_COLORS];
+    for (unsigned c = 0; c < PALETTE_COLORS; c++) {
+        channels[0][c] = table[c];
+        channels[1][c] = table[c] >> 8;
+        channels[2][c] = table[c] >> 16;
+    }
+    __m128i tables[3][4];
+    for (unsigned c = 0; c < 3; c++) {
+        for (unsigned t = 0; t < 4; t++) {
+            tables[c][t] = _mm_loadu_si128((const __m128i*) &channels[c][t * 16]);
+        }
+    }
+
+    const __m128i zero = _mm_setzero_si128();
+    unsigned i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i index = _mm_loadu_si128((const __m128i*) (indices + i));
+        __m128i low = _mm_and_si128(index, _mm_set1_epi8(0x0f));
+        __m128i high = _mm_and_si128(_mm_srli_epi16(index, 4), _mm_set1_epi8(0x03));
+        __m128i blue = zero, green = zero, red = zero;
+        for (unsigned t = 0; t < 4; t++) {
+            __m128i select = _mm_cmpeq_epi8(high, _mm_set1_epi8(t));
+            blue = _mm_or_si128(blue, _mm_and_si128(select, _mm_shuffle_epi8(tables[0][t], low)));
+            green = _mm_or_si128(green, _mm_and_si128(select, _mm_shuffle_epi8(tables[1][t], low)));
+            red = _mm_or_si128(red, _mm_and_si128(select, _mm_shuffle_epi8(tables[2][t], low)));
+        }
+        // interleave to little-endian b, g, r, 0 words
+        __m128i blue_green_lo = _mm_unpacklo_epi8(blue, green);
+        __m128i blue_green_hi = _mm_unpackhi_epi8(blue, green);
+        __m128i red_lo = _mm_unpacklo_epi8(red, zero);
+        __m128i red_hi = _mm_unpackhi_epi8(red, zero);
+        _mm_storeu_si128((__m128i*) (rgb + i), _mm_unpacklo_epi16(blue_green_lo, red_lo));
+        _mm_storeu_si128((__m128i*) (rgb + i + 4), _mm_unpackhi_epi16(blue_green_lo, red_lo));
+        _mm_storeu_si128((__m128i*) (rgb + i + 8), _mm_unpacklo_epi16(blue_green_hi, red_hi));
+        _mm_storeu_si128((__m128i*) (rgb + i + 12), _mm_unpackhi_epi16(blue_green_hi, red_hi));
+    }
+    return i;
+}
+#endif
+
+#ifdef SSSE3_KERNELS
+// luma of palette indices, 16 per step as four 16-entry byte shuffles, returns pixels converted
+__attribute__((target("ssse3")))
+static unsigned palette_to_gray_ssse3(const uint8_t *indices, unsigned count, uint8_t *gray) {
+    __m128i tables[4];
+    for (unsigned t = 0; t < 4; t++) {
+        tables[t] = _mm_loadu_si128((const __m128i*) &luma_table[t * 16]);
+    }
+    const __m128i low_mask = _mm_set1_epi8(0x0f);
+    unsigned i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i index = _mm_and_si128(_mm_loadu_si128((const __m128i*) (indices + i)), _mm_set1_epi8(0x3f));
+        __m128i low = _mm_and_si128(index, low_mask);
+        __m128i high = _mm_srli_epi16(index, 4); // 16-bit shift is fine, stray bits are masked below
+        __m128i result = _mm_setzero_si128();
+        for (unsigned t = 0; t < 4; t++) {
+            __m128i select = _mm_cmpeq_epi8(_mm_and_si128(high, _mm_set1_epi8(0x03)), _mm_set1_epi8(t));
+            result = _mm_or_si128(result, _mm_and_si128(select, _mm_shuffle_epi8(tables[t], low)));
+        }
+        _mm_storeu_si128((__m128i*) (gray + i), result);
+    }
+    return i;
+}
+#endif
+
+// lookup tables of every conversion, and the kernels they feed once per process
+static void init_palette_tables() {
+    fill_rgb_table();
+    for (unsigned i = 0; i < PALETTE_COLORS; i++) {
+        luma_table[i] = palette_luma(i);
+    }
+#ifdef SSSE3_KERNELS
+    palette_ssse3 = __builtin_cpu_supports("ssse3");
+#endif
+}
+
+uint32_t palette_rgb(uint8_t index, uint8_t emphasis) {
+    pthread_once(&palette_once, init_palette_tables);
+    return rgb_table[(emphasis & 7) * PALETTE_COLORS + index % PALETTE_COLORS];
+}
+
+// converts indices drawn under one emphasis setting to 0x00RRGGBB
+void palette_to_rgb(const uint8_t *indices, unsigned count, uint8_t emphasis, uint32_t *rgb) {
+    pthread_once(&palette_once, init_palette_tables);
+    const uint32_t *table = &rgb_table[(emphasis & 7) * PALETTE_COLORS];
+    unsigned i = 0;
+#ifdef SSSE3_KERNELS
+    if (palette_ssse3) {
+        i = palette_to_rgb_ssse3(indices, count, table, rgb);
+    }
+#endif
+    for (; i < count; i++) {
+        rgb[i] = table[indices[i] % PALETTE_COLORS];
+    }
+}
+
+// luma of count palette indices
+void palette_to_gray(const uint8_t *indices, unsigned count, uint8_t *gray) {
+    pthread_once(&palette_once, init_palette_tables);
+    unsigned i = 0;
+#ifdef SSSE3_KERNELS
+    if (palette_ssse3) {
+        i = palette_to_gray_ssse3(indices, count, gray);
+    }
+#endif
+    for (; i < count; i++) {
+        gray[i] = luma_table[indices[i] % PALETTE_COLORS];
+    }
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdint.h>
+
+#define PALETTE_COLORS 64
+#define PALETTE_ENTRIES 512 // every color index under each of the 8 emphasis combinations
+
+extern const uint32_t nes_palette_rgb[PALETTE_COLORS]; // 0xRRGGBB per 2C02 color index
+
+uint8_t palette_luma(uint8_t index);
+uint32_t palette_rgb(uint8_t index, uint8_t emphasis);
+void palette_to_rgb(const uint8_t *indices, unsigned count, uint8_t emphasis, uint32_t *rgb);
+void palette_to_gray(const uint8_t *indices, unsigned count, uint8_t *gray);
@@ -0,0 +1,95 @@
+#include "pool.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define SLOT_NONE 0
+
+static NES *slot_nes(const NESPool *pool, uint32_t slot) {
+    return (NES*) (pool->memory + (size_t) slot * sizeof(NES));
+}
+
+// slots are carved from one mapping the kernel may back with huge pages, every slot is written here
+// so its pages are faulted in up front, on the memory node of the creating thread
+NESPool *new_nes_pool(const ROM *rom, unsigned slots) {
+    size_t size = ((size_t) slots * sizeof(NES) + POOL_PAGE_SIZE - 1) / POOL_PAGE_SIZE * POOL_PAGE_SIZE;
+    void *memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (!slots || memory == MAP_FAILED) {
+        return NULL;
+    }
+    madvise(memory, size, MADV_HUGEPAGE); // a hint, pools still work on 4k pages
+
+    NESPool *pool = (NESPool*) calloc(1, sizeof(NESPool));
+    pool->rom = rom;
+    pool->slots = slots;
+    pool->memory = (uint8_t*) memory;
+    pool->memory_size = size;
+    pool->pristine = new_NES(rom);
+    pool->next_free = (uint32_t*) calloc(slots, sizeof(uint32_t));
+    for (uint32_t i = 0; i < slots; i++) {
+        memcpy(slot_nes(pool, i), pool->pristine, sizeof(NES));
+        pool->next_free[i] = i + 1 < slots ? i + 2 : SLOT_NONE;
+    }
+    pool->free_head = 1;
+    return pool;
+}
+
+// every slot must have been released
+void delete_nes_pool(NESPool *pool) {
+    munmap(pool->memory, pool->memory_size);
+    delete_nes(pool->pristine);
+    free(pool->next_free);
+    free(pool);
+}
+
+bool pool_owns(const NESPool *pool, const NES *nes) {
+    const uint8_t *address = (const uint8_t*) nes;
+    return address >= pool->memory && address < pool->memory + (size_t) pool->slots * sizeof(NES);
+}
+
+// powered-on console from the pool, NULL once every slot is in use
+NES *acquire_nes(NESPool *pool) {
+    uint64_t head = __atomic_load_n(&pool->free_head, __ATOMIC_ACQUIRE);
+    for (;;) {
+        uint32_t slot = (uint32_t) head;
+        if (slot == SLOT_NONE) {
+            return NULL;
+        }
+        uint64_t next = ((head >> 32) + 1) << 32 | __atomic_load_n(&pool->next_free[slot - 1], __ATOMIC_RELAXED);
+        if (__atomic_compare_exchange_n(&pool->free_head, &head, next, true, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+            return slot_nes(pool, slot - 1);
+        }
+    }
+}
+
+// restores a used console to the pristine one, copying only what running it can have changed:
+// chr ram is only written on cartridges without chr rom, and a framebuffer only once rows of a frame,
+// complete or still in progress, were drawn to it
+static void recycle(NESPool *pool, NES *nes) {
+    const NES *pristine = pool->pristine;
+    uint32_t drawn = nes->ppu.frame + (nes->ppu.next_line != 0); // frames with at least one row drawn
+
+    memcpy(nes, pristine, offsetof(NES, ppu.chr_ram));
+    if (!pool->rom->chr_len) {
+        memcpy(nes->ppu.chr_ram, pristine->ppu.chr_ram, CHR_RAM_SIZE);
+    }
+    if (drawn) { // the first frame goes to the back buffer, framebuffers[1]
+        memcpy(nes->ppu.framebuffers[1], pristine->ppu.framebuffers[1], SCREEN_WIDTH * SCREEN_HEIGHT);
+    }
+    if (drawn > 1) {
+        memcpy(nes->ppu.framebuffers[0], pristine->ppu.framebuffers[0], SCREEN_WIDTH * SCREEN_HEIGHT);
+    }
+    memcpy(nes->ppu.palette, pristine->ppu.palette, sizeof(NES) - offsetof(NES, ppu.palette));
+}
+
+void release_nes(NESPool *pool, NES *nes) {
+    delete_watches(nes->watches);
+    recycle(pool, nes);
+
+    uint32_t slot = (uint32_t) (((uint8_t*) nes - pool->memory) / sizeof(NES)) + 1;
+    uint64_t head = __atomic_load_n(&pool->free_head, __ATOMIC_RELAXED);
+    do {
+        __atomic_store_n(&pool->next_free[slot - 1], (uint32_t) head, __ATOMIC_RELAXED);
+    } while (!__atomic_compare_exchange_n(&pool->free_head, &head, (head & ~(uint64_t) UINT32_MAX) | slot, true,
+            __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "nes.h"
+
+#define POOL_PAGE_SIZE (2 << 20) // huge page, the slot region is rounded up to it
+
+// fixed set of preallocated consoles for one rom, recycled instead of freed
+typedef struct NESPool {
+    const ROM *rom;
+    unsigned slots;
+    uint8_t *memory;        // anonymous mapping holding every slot back to back
+    size_t memory_size;
+    NES *pristine;          // powered-on console released slots are restored from
+    uint32_t *next_free;    // free list links, indexed by slot
+    uint64_t free_head;     // [TAG (32) | SLOT + 1 (32)], the tag changes on every pop so stale heads fail to swap
+} NESPool;
+
+NESPool *new_nes_pool(const ROM *rom, unsigned slots);
+void delete_nes_pool(NESPool *pool);
+NES *acquire_nes(NESPool *pool);
+void release_nes(NESPool *pool, NES *nes);
+bool pool_owns(const NESPool *pool, const NES *nes);
@@ -0,0 +1,361 @@
+#include "ppu.h"
+#include "nes.h"
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// maps nametable address onto the 2 KiB of internal vram according to cartridge wiring
+static uint16_t nametable_index(const ROM *rom, uint16_t addr) {
+    addr = (addr - 0x2000) % 0x1000;
+    if (rom->vertical_mirroring) {
+        return addr % NAMETABLE_RAM_SIZE;
+    }
+    return ((addr >> 1) & 0x400) | (addr & 0x3ff); // horizontal mirroring
+}
+
+static uint8_t palette_index(uint16_t addr) {
+    addr %= PALETTE_RAM_SIZE;
+    if ((addr & 0x13) == 0x10) { // sprite backdrop entries mirror background ones
+        addr &= 0x0f;
+    }
+    return addr;
+}
+
+uint8_t ppu_read_vram(NES *nes, uint16_t addr) {
+    addr &= 0x3fff;
+    if (addr <= 0x1fff) { // pattern tables
+        return nes->rom->chr_len ? nes->rom->chr[addr % nes->rom->chr_len] : nes->ppu.chr_ram[addr];
+    } else if (addr <= 0x3eff) {
+        return nes->ppu.nametables[nametable_index(nes->rom, addr)];
+    }
+    return nes->ppu.palette[palette_index(addr)];
+}
+
+void ppu_write_vram(NES *nes, uint16_t addr, uint8_t value) {
+    addr &= 0x3fff;
+    if (addr <= 0x1fff) {
+        if (!nes->rom->chr_len) { // chr rom is read-only
+            nes->ppu.chr_ram[addr] = value;
+            mark_ppu_dirty(nes, &nes->ppu.chr_ram[addr]);
+        }
+    } else if (addr <= 0x3eff) {
+        uint8_t *byte = &nes->ppu.nametables[nametable_index(nes->rom, addr)];
+        *byte = value;
+        mark_ppu_dirty(nes, byte);
+    } else {
+        nes->ppu.palette[palette_index(addr)] = value;
+        mark_ppu_dirty(nes, nes->ppu.palette);
+    }
+}
+
+// vertical scroll held in a vram address, as a row counted from the top of nametable 0
+static uint16_t vram_addr_y(uint16_t addr) {
+    return (((addr >> 5) & 0x1f) << 3) | ((addr >> 12) & 0x07) | ((addr & 0x800) ? SCREEN_HEIGHT : 0);
+}
+
+static void increment_vram_addr(PPU *ppu) {
+    ppu->vram_addr += get_bit(ppu->ctrl, 2) ? 32 : 1;
+}
+
+uint8_t ppu_read_reg(NES *nes, uint16_t addr) {
+    PPU *ppu = &nes->ppu;
+    uint8_t value = 0;
+    ppu_catch_up(nes);
+    switch (addr % 8) { // registers mirrored every 8 bytes
+        case 2:
+            value = (ppu->status & 0xe0) | (ppu->read_buffer & 0x1f);
+            set_bit(&ppu->status, VBLANK, 0); // reading status acknowledges vblank
+            ppu->write_latch = false;
+            break;
+        case 4:
+            value = ppu->oam[ppu->oam_addr];
+            break;
+        case 7:
+            if ((ppu->vram_addr & 0x3fff) >= 0x3f00) { // palette reads are not delayed
+                value = ppu_read_vram(nes, ppu->vram_addr);
+                ppu->read_buffer = ppu_read_vram(nes, ppu->vram_addr - 0x1000);
+            } else {
+                value = ppu->read_buffer;
+                ppu->read_buffer = ppu_read_vram(nes, ppu->vram_addr);
+            }
+            increment_vram_addr(ppu);
+            break;
+    }
+    return value;
+}
+
+void ppu_write_reg(NES *nes, uint16_t addr, uint8_t value) {
+    PPU *ppu = &nes->ppu;
+    ppu_catch_up(nes); // lines already scanned out keep the registers they were drawn with
+    switch (addr % 8) {
+        case 0: {
+            bool nmi_was_enabled = get_bit(ppu->ctrl, 7);
+            ppu->ctrl = value;
+            ppu->temp_addr = (ppu->temp_addr & 0xf3ff) | ((value & 0x03) << 10);
+            if (!nmi_was_enabled && get_bit(value, 7) && get_bit(ppu->status, VBLANK)) {
+                raise_nmi(nes); // enabling nmi during vblank triggers it immediately
+            }
+            break;
+        }
+        case 1:
+            ppu->mask = value;
+            break;
+        case 3:
+            ppu->oam_addr = value;
+            break;
+        case 4:
+            ppu->oam[ppu->oam_addr++] = value;
+            mark_ppu_dirty(nes, ppu->oam);
+            break;
+        case 5:
+            if (!ppu->write_latch) {
+                ppu->temp_addr = (ppu->temp_addr & 0xffe0) | (value >> 3);
+                ppu->fine_x = value & 0x07;
+            } else {
+                ppu->temp_addr = (ppu->temp_addr & 0x8c1f) | ((value & 0x07) << 12) | ((value & 0xf8) << 2);
+            }
+            ppu->write_latch = !ppu->write_latch;
+            break;
+        case 6:
+            if (!ppu->write_latch) {
+                ppu->temp_addr = (ppu->temp_addr & 0x00ff) | ((value & 0x3f) << 8);
+            } else {
+                ppu->temp_addr = (ppu->temp_addr & 0xff00) | value;
+                ppu->vram_addr = ppu->temp_addr;
+                ppu->line_y = vram_addr_y(ppu->vram_addr); // mid-frame writes move the vertical scroll
+            }
+            ppu->write_latch = !ppu->write_latch;
+            break;
+        case 7:
+            ppu_write_vram(nes, ppu->vram_addr, value);
+            increment_vram_addr(ppu);
+            break;
+    }
+}
+
+// converts a ppu dot within a frame into the first cpu cycle at or after it
+uint64_t ppu_dot_cycle(uint32_t frame, unsigned scanline, unsigned dot) {
+    uint64_t dots = (uint64_t) frame * PPU_DOTS_PER_FRAME + scanline * PPU_DOTS_PER_SCANLINE + dot;
+    return (dots + PPU_DOTS_PER_CPU_CYCLE - 1) / PPU_DOTS_PER_CPU_CYCLE;
+}
+
+// 2-bit pixel of a pattern table tile row
+static uint8_t pattern_pixel(NES *nes, uint16_t addr, unsigned col) {
+    const ROM *rom = nes->rom;
+    if (rom->chr_pixels && (addr & 0x1fff) < rom->chr_len) { // chr rom predecoded, addr is a low plane row
+        return rom->chr_pixels[((addr & 0x1fff) / 16) * 64 + (addr % 8) * 8 + col];
+    }
+    uint8_t lo = ppu_read_vram(nes, addr);
+    uint8_t hi = ppu_read_vram(nes, addr + 8);
+    unsigned bit = 7 - col;
+    return (((hi >> bit) & 1) << 1) | ((lo >> bit) & 1);
+}
+
+// background pixels of one scanline showing background row world_y, horizontal scroll is taken from
+// the temporary vram address
+static void render_background(NES *nes, unsigned world_y, uint8_t *line, uint8_t *opaque) {
+    PPU *ppu = &nes->ppu;
+    unsigned scroll_x = ((ppu->temp_addr & 0x1f) << 3) | ppu->fine_x | ((ppu->temp_addr & 0x400) ? 256 : 0);
+    uint16_t table = get_bit(ppu->ctrl, 4) ? 0x1000 : 0;
+    world_y %= 2 * SCREEN_HEIGHT;
+
+    for (unsigned x = 0; x < SCREEN_WIDTH; x++) {
+        unsigned world_x = (x + scroll_x) % (2 * SCREEN_WIDTH);
+        uint16_t nametable = 0x2000 + 0x400 * (world_x / SCREEN_WIDTH + 2 * (world_y / SCREEN_HEIGHT));
+        unsigned col = (world_x % SCREEN_WIDTH) / 8;
+        unsigned row = (world_y % SCREEN_HEIGHT) / 8;
+
+        uint8_t tile = ppu_read_vram(nes, nametable + row * 32 + col);
+        uint8_t attribute = ppu_read_vram(nes, nametable + 0x3c0 + (row / 4) * 8 + col / 4);
+        uint8_t palette = (attribute >> (((row & 2) << 1) | (col & 2))) & 3;
+        uint8_t pixel = pattern_pixel(nes, table + tile * 16 + world_y % 8, world_x % 8);
+
+        if (x < 8 && !get_bit(ppu->mask, 1)) { // left column clipped
+            pixel = 0;
+        }
+        opaque[x] = pixel != 0;
+        line[x] = ppu->palette[pixel ? palette * 4 + pixel : 0];
+    }
+}
+
+// sprite evaluation, bit i is set when sprite i covers the scanline, tops holds the 64 y coordinates
+// in range means top <= y - 1 <= top + height - 1, sprites being delayed by one scanline
+static uint64_t sprites_on_line(const uint8_t *tops, unsigned y, unsigned height) {
+    if (y == 0) {
+        return 0;
+    }
+    uint8_t last = y - 1;                                   // highest top still covering the line
+    uint8_t first = y > height ? y - height : 0;            // lowest
+    uint64_t covered = 0;
+    unsigned i = 0;
+#ifdef __SSE2__
+    __m128i lo = _mm_set1_epi8((char) first);
+    __m128i hi = _mm_set1_epi8((char) last);
+    for (; i < OAM_SIZE / 4; i += 16) {
+        __m128i top = _mm_loadu_si128((const __m128i*) (tops + i));
+        __m128i in_range = _mm_and_si128(_mm_cmpeq_epi8(_mm_max_epu8(top, lo), top),
+                _mm_cmpeq_epi8(_mm_min_epu8(top, hi), top));
+        covered |= (uint64_t) (uint16_t) _mm_movemask_epi8(in_range) << i;
+    }
+#endif
+    for (; i < OAM_SIZE / 4; i++) {
+        covered |= (uint64_t) (tops[i] >= first && tops[i] <= last) << i;
+    }
+    return covered;
+}
+
+// sprite pixels of one scanline, lower oam index wins among overlapping sprites
+static void render_sprites(NES *nes, unsigned y, const uint8_t *tops, uint8_t *line, const uint8_t *opaque) {
+    PPU *ppu = &nes->ppu;
+    unsigned height = get_bit(ppu->ctrl, 5) ? 16 : 8;
+    bool drawn[SCREEN_WIDTH] = {0};
+
+    for (uint64_t covered = sprites_on_line(tops, y, height); covered; covered &= covered - 1) {
+        unsigned i = __builtin_ctzll(covered);
+        const uint8_t *sprite = &ppu->oam[i * 4];
+        unsigned top = sprite[0] + 1; // sprites are delayed by one scanline
+
+        uint8_t attribute = sprite[2];
+        unsigned row = y - top;
+        if (get_bit(attribute, 7)) { // vertical flip
+            row = height - 1 - row;
+        }
+        uint16_t addr;
+        if (height == 16) {
+            addr = ((sprite[1] & 1) ? 0x1000 : 0) + (sprite[1] & 0xfe) * 16 + (row & 8) * 2 + (row & 7);
+        } else {
+            addr = (get_bit(ppu->ctrl, 3) ? 0x1000 : 0) + sprite[1] * 16 + row;
+        }
+
+        for (unsigned col = 0; col < 8; col++) {
+            unsigned x = sprite[3] + col;
+            if (x >= SCREEN_WIDTH || drawn[x] || (x < 8 && !get_bit(ppu->mask, 2))) {
+                continue;
+            }
+            uint8_t pixel = pattern_pixel(nes, addr, get_bit(attribute, 6) ? 7 - col : col);
+            if (!pixel) {
+                continue;
+            }
+            drawn[x] = true;
+            if (!get_bit(attribute, 5) || !opaque[x]) { // behind-background sprites show through backdrop only
+                line[x] = ppu->palette[0x10 + (attribute & 3) * 4 + pixel];
+            }
+        }
+    }
+}
+
+// draws the current frame's scanlines up to end into the back framebuffer as 6-bit palette indices,
+// each with the registers as they are now
+static void render_lines(NES *nes, unsigned end) {
+    PPU *ppu = &nes->ppu;
+    if (ppu->next_line >= end) {
+        return;
+    }
+    uint8_t opaque[SCREEN_WIDTH];
+    uint8_t tops[OAM_SIZE / 4]; // sprite y coordinates gathered once, oam cannot change while lines are drawn
+    for (unsigned i = 0; i < OAM_SIZE / 4; i++) {
+        tops[i] = ppu->oam[i * 4];
+    }
+    uint8_t *framebuffer = ppu->framebuffers[!ppu->front];
+    uint8_t line[SCREEN_WIDTH];
+    bool rendering = ppu->mask & 0x18;
+    for (unsigned y = ppu->next_line; y < end; y++) {
+        if (y == 0 && rendering) { // the pre-render scanline reloads the vertical scroll
+            ppu->line_y = vram_addr_y(ppu->temp_addr);
+        }
+        if (get_bit(ppu->mask, 3)) {
+            render_background(nes, ppu->line_y, line, opaque);
+        } else {
+            memset(line, ppu->palette[0], SCREEN_WIDTH);
+            memset(opaque, 0, SCREEN_WIDTH);
+        }
+        if (get_bit(ppu->mask, 4)) {
+            render_sprites(nes, y, tops, line, opaque);
+        }
+        if (rendering) {
+            ppu->line_y = (ppu->line_y + 1) % (2 * SCREEN_HEIGHT);
+        }
+        uint8_t color_mask = get_bit(ppu->mask, 0) ? 0x30 : 0x3f; // grayscale keeps only the luma column
+        for (unsigned x = 0; x < SCREEN_WIDTH; x++) {
+            line[x] &= color_mask;
+        }
+        uint8_t *row = &framebuffer[y * SCREEN_WIDTH]; // a row is one tracked page, only marked if it changed
+        if (memcmp(row, line, SCREEN_WIDTH)) {
+            memcpy(row, line, SCREEN_WIDTH);
+            mark_ppu_dirty(nes, row);
+        }
+    }
+    ppu->next_line = end;
+}
+
+// first cpu cycle at which the current frame's scanline y can be drawn, the ppu copies the horizontal
+// scroll for a line at dot 257 of the scanline before it
+static uint64_t line_ready_cycle(const PPU *ppu, unsigned y) {
+    uint64_t dots = (uint64_t) ppu->frame * PPU_DOTS_PER_FRAME + y * PPU_DOTS_PER_SCANLINE + 257;
+    if (dots < PPU_DOTS_PER_SCANLINE) { // pre-render scanline before the first frame
+        return 0;
+    }
+    return (dots - PPU_DOTS_PER_SCANLINE + PPU_DOTS_PER_CPU_CYCLE - 1) / PPU_DOTS_PER_CPU_CYCLE;
+}
+
+// draws every visible scanline the cpu clock has already passed, so that a register, vram or oam write
+// only shows on the lines scanned out after it; called before every ppu register access and oam dma
+void ppu_catch_up(NES *nes) {
+    PPU *ppu = &nes->ppu;
+    unsigned end = ppu->next_line;
+    while (end < SCREEN_HEIGHT && line_ready_cycle(ppu, end) <= nes->cpu.cycles) {
+        end++;
+    }
+    render_lines(nes, end);
+}
+
+// draws the lines no register access caught up with and makes the frame the front one
+// emphasis is kept per frame so rgb conversion can be deferred to whoever wants pixels
+static void ppu_start_vblank(NES *nes) {
+    PPU *ppu = &nes->ppu;
+    render_lines(nes, SCREEN_HEIGHT);
+    ppu->emphasis[!ppu->front] = ppu->mask >> 5;
+    ppu->front = !ppu->front;
+
+    set_bit(&ppu->status, VBLANK, 1);
+    ppu->frame++;
+    ppu->in_vblank = true;
+    if (get_bit(ppu->ctrl, 7)) {
+        raise_nmi(nes);
+    }
+}
+
+static void ppu_end_vblank(NES *nes) {
+    set_bit(&nes->ppu.status, VBLANK, 0);
+    set_bit(&nes->ppu.status, SPRITE_ZERO_HIT, 0);
+    set_bit(&nes->ppu.status, SPRITE_OVERFLOW, 0);
+    nes->ppu.in_vblank = false;
+    nes->ppu.next_line = 0;
+}
+
+// ppu state machine, scheduled at its two fixed points: entering vblank, where it finishes the frame,
+// and leaving it on the pre-render scanline; scanlines in between are drawn by ppu_catch_up
+// returns the cpu cycle of its next scheduled step
+uint64_t resume_ppu(NES *nes) {
+    if (!nes->ppu.in_vblank) {
+        ppu_start_vblank(nes);
+        return ppu_dot_cycle(nes->ppu.frame - 1, PPU_PRE_RENDER_SCANLINE, 1);
+    }
+    ppu_end_vblank(nes);
+    return ppu_dot_cycle(nes->ppu.frame, PPU_VBLANK_SCANLINE, 1);
+}
+
+const uint8_t *ppu_frame(const PPU *ppu) {
+    return ppu->framebuffers[ppu->front];
+}
+
+uint8_t ppu_frame_emphasis(const PPU *ppu) {
+    return ppu->emphasis[ppu->front];
+}
+
+// frame completed before the current one, for consumers blending consecutive frames
+const uint8_t *ppu_previous_frame(const PPU *ppu) {
+    return ppu->framebuffers[!ppu->front];
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define PPU_DOTS_PER_SCANLINE 341
+#define PPU_SCANLINES_PER_FRAME 262
+#define PPU_VBLANK_SCANLINE 241
+#define PPU_PRE_RENDER_SCANLINE 261
+#define PPU_DOTS_PER_CPU_CYCLE 3
+#define PPU_DOTS_PER_FRAME (PPU_DOTS_PER_SCANLINE * PPU_SCANLINES_PER_FRAME)
+
+#define OAM_SIZE 256
+#define NAMETABLE_RAM_SIZE 2048
+#define PALETTE_RAM_SIZE 32
+#define CHR_RAM_SIZE 8192
+
+#define SCREEN_WIDTH 256
+#define SCREEN_HEIGHT 240
+
+typedef struct NES NES;
+
+typedef enum PPU_STATUS_BIT {
+    SPRITE_OVERFLOW = 5,
+    SPRITE_ZERO_HIT = 6,
+    VBLANK = 7
+} PPU_STATUS_BIT;
+
+typedef struct PPU {
+    uint8_t ctrl;                           // $2000 [NMI ENABLE | MASTER/SLAVE | SPRITE SIZE | BG TABLE | SPRITE TABLE | VRAM INCREMENT | NAMETABLE (2)]
+    uint8_t mask;                           // $2001 [EMPHASIS (3) | SHOW SPRITES | SHOW BG | SPRITES LEFT | BG LEFT | GRAYSCALE]
+    uint8_t status;                         // $2002 [VBLANK | SPRITE 0 HIT | SPRITE OVERFLOW | (open bus)]
+    uint8_t oam_addr;                       // $2003
+    uint16_t vram_addr;                     // current vram address (v)
+    uint16_t temp_addr;                     // temporary vram address (t)
+    uint8_t fine_x;                         // fine x scroll
+    bool write_latch;                       // first/second write toggle shared by $2005 and $2006 (w)
+    uint8_t read_buffer;                    // delayed $2007 read value
+    uint32_t frame;                         // frames completed since power-on
+    bool in_vblank;                         // state machine position, unlike the status bit not cleared by reads
+    uint8_t next_line;                      // first visible scanline of the current frame not yet drawn
+    uint16_t line_y;                        // background row the next drawn scanline shows, counted from nametable 0
+    uint8_t oam[OAM_SIZE];                  // sprite memory
+    uint8_t nametables[NAMETABLE_RAM_SIZE]; // internal vram, mirrored per cartridge
+    uint8_t chr_ram[CHR_RAM_SIZE];          // pattern tables for cartridges without chr rom
+    uint8_t framebuffers[2][SCREEN_WIDTH * SCREEN_HEIGHT]; // last two completed frames as palette indices
+    uint8_t palette[PALETTE_RAM_SIZE];      // last of the page-tracked memories, oam up to here
+    uint8_t front;                          // framebuffer holding the last completed frame
+    uint8_t emphasis[2];                    // color emphasis bits (mask bits 5-7) each framebuffer was drawn with
+} PPU;
+
+uint8_t ppu_read_reg(NES *nes, uint16_t addr);
+void ppu_write_reg(NES *nes, uint16_t addr, uint8_t value);
+uint8_t ppu_read_vram(NES *nes, uint16_t addr);
+void ppu_write_vram(NES *nes, uint16_t addr, uint8_t value);
+uint64_t ppu_dot_cycle(uint32_t frame, unsigned scanline, unsigned dot);
+uint64_t resume_ppu(NES *nes);
+void ppu_catch_up(NES *nes);
+const uint8_t *ppu_frame(const PPU *ppu);
+const uint8_t *ppu_previous_frame(const PPU *ppu);
+uint8_t ppu_frame_emphasis(const PPU *ppu);
@@ -1,4 +1,5 @@
 #include "ram.h"
+#include "nes.h"
 
 uint8_t *access_ram(uint8_t *ram, uint16_t addr) {
     if (addr <= 0x07ff) {
@@ -24,3 +25,63 @@ uint8_t *access_ram(uint8_t *ram, uint16_t addr) {
 inline bool page_crossed(uint16_t addr1, uint16_t addr2) {
     return (addr1 & 0xff00) != (addr2 & 0xff00);
 }
+
+// cpu memory map read, dispatching to ram, memory-mapped registers and cartridge
+uint8_t read_mem(NES *nes, uint16_t addr) {
+    uint8_t value = 0; // expansion rom, prg ram and the remaining apu and i/o registers
+    if (addr <= 0x1fff) {
+        value = *access_ram(nes->ram, addr);
+    } else if (addr <= 0x3fff) {
+        value = ppu_read_reg(nes, addr);
+    } else if (addr == 0x4015) {
+        value = apu_read_status(nes);
+    } else if (addr == 0x4016 || addr == 0x4017) {
+        value = read_controller(&nes->controllers[addr - 0x4016], nes->strobe);
+    } else if (addr >= 0x8000) {
+        value = read_prg(nes->rom, addr);
+    }
+
+    if (nes->watches && nes->watches->pages[addr >> 8]) { // watched pages take the slow path
+        watch_read(nes, addr, value);
+    }
+    return value;
+}
+
+// page table entry of the cpu memory map: the host memory behind a 256 byte page when reading it is
+// free of side effects, NULL for pages holding registers or unmapped space
+const uint8_t *direct_page(const NES *nes, uint8_t page) {
+    if (page < 0x20) {
+        return &nes->ram[(page & 0x07) << 8]; // mirrored ram
+    } else if (page >= 0x80 && nes->rom->prg_len) {
+        return &nes->rom->prg[prg_offset(nes->rom, page << 8)]; // banks are whole pages
+    }
+    return NULL;
+}
+
+uint16_t read_mem16(NES *nes, uint16_t addr) {
+    return (read_mem(nes, addr + 1) << 8) | read_mem(nes, addr);
+}
+
+// cpu memory map write, writes to cartridge rom are ignored
+void write_mem(NES *nes, uint16_t addr, uint8_t value) {
+    if (nes->watches && nes->watches->pages[addr >> 8]) {
+        watch_write(nes, addr, value);
+    }
+    if (addr <= 0x1fff) {
+        *access_ram(nes->ram, addr) = value;
+        mark_ram_dirty(nes, addr % NES_RAM_SIZE);
+    } else if (addr <= 0x3fff) {
+        ppu_write_reg(nes, addr, value);
+    } else if (addr == 0x4014) { // oam dma, performed once the writing instruction completes
+        nes->dma_page = value;
+        schedule_component(nes, COMPONENT_DMA, nes->cpu.cycles);
+    } else if (addr == 0x4016) {
+        nes->strobe = get_bit(value, 0);
+        if (nes->strobe) {
+            latch_controller(&nes->controllers[0]);
+            latch_controller(&nes->controllers[1]);
+        }
+    } else if (addr == 0x4017) {
+        apu_write_frame_counter(nes, value);
+    }
+}
@@ -25,4 +25,8 @@ typedef enum ADDR_MODE {
 } ADDR_MODE;
 
 uint8_t *access_ram(uint8_t *ram, uint16_t addr);
+uint8_t read_mem(NES *nes, uint16_t addr);
+uint16_t read_mem16(NES *nes, uint16_t addr);
+const uint8_t *direct_page(const NES *nes, uint8_t page);
+void write_mem(NES *nes, uint16_t addr, uint8_t value);
 bool page_crossed(uint16_t addr1, uint16_t addr2);
@@ -1,50 +1,194 @@
 #include "rom.h"
+#include "hash.h"
+#include "native.h"
+#include "analysis.h"
+#include <sys/mman.h>
+#include <string.h>
 
-bool parse_rom(FILE *rom_file, ROM *rom) {
-    if (rom_file == NULL) {
-        return false;
+// validates an ines header against the image size
+ROM_STATUS read_rom_header(const uint8_t *data, size_t size, ROMHeader *header) {
+    memset(header, 0, sizeof(ROMHeader));
+    if (size < 4 || memcmp(data, INES_MAGIC, 4)) {
+        return ROM_BAD_MAGIC;
+    }
+    if (size < PRG_BLOCK_BEGIN_LOC) { // ines file cut off inside its header
+        return ROM_TRUNCATED;
     }
 
-    unsigned prg_length = 0;
-    fseek(rom_file, PRG_LEN_BYTE_LOC, SEEK_SET); // access prg length from rom header
-    fread(&prg_length, 1, 1, rom_file);
-    prg_length *= PRG_BLOCK_SIZE;
+    uint8_t flags6 = data[FLAGS6_BYTE_LOC];
+    uint8_t flags7 = data[FLAGS7_BYTE_LOC];
+    header->vertical_mirroring = get_bit(flags6, 0);
+    header->battery = get_bit(flags6, 1);
+    header->trainer = get_bit(flags6, 2);
+    header->nes2 = (flags7 & 0x0c) == 0x08;
+    header->mapper = (flags6 >> 4) | (flags7 & 0xf0);
+    if (header->nes2) {
+        header->mapper |= (data[8] & 0x0f) << 8;
+    }
 
-    unsigned chr_length = 0;
-    fseek(rom_file, CHR_LEN_BYTE_LOC, SEEK_SET); // access chr length from rom header
-    fread(&chr_length, 1, 1, rom_file);
-    chr_length *= CHR_BLOCK_SIZE;
+    header->prg_len = data[PRG_LEN_BYTE_LOC] * PRG_BLOCK_SIZE;
+    header->chr_len = data[CHR_LEN_BYTE_LOC] * CHR_BLOCK_SIZE;
+    header->prg_start = PRG_BLOCK_BEGIN_LOC + (header->trainer ? TRAINER_SIZE : 0);
+    if (!header->prg_len) {
+        return ROM_NO_PRG;
+    }
 
-    rom->prg = (uint8_t*) calloc(prg_length + 1, sizeof(uint8_t));
-    rom->chr = (uint8_t*) calloc(chr_length + 1, sizeof(uint8_t));
+    size_t expected = (size_t) header->prg_start + header->prg_len + header->chr_len;
+    if (size < expected) {
+        return ROM_TRUNCATED;
+    }
+    header->trailing_data = size > expected;
+    return ROM_OK;
+}
 
-    fseek(rom_file, PRG_BLOCK_BEGIN_LOC, SEEK_SET);
-    for (unsigned i = 0; i < prg_length; i++) {
-        if (!fread(rom->prg + i, 1, 1, rom_file)) { // fill in string with binary prg data
-            return false;
-        }
+const char *rom_status_name(ROM_STATUS status) {
+    switch (status) {
+        case ROM_OK:
+            return "ok";
+        case ROM_UNREADABLE:
+            return "unreadable";
+        case ROM_BAD_MAGIC:
+            return "not an ines image";
+        case ROM_NO_PRG:
+            return "no prg rom";
+        case ROM_TRUNCATED:
+            return "truncated";
     }
-    rom->prg[prg_length] = '\0';  // null-terminate data
+    return "unknown";
+}
 
-    for (unsigned i = 0; i < chr_length; i++) {
-        if (!fread(rom->chr + i, 1, 1, rom_file)) { // fill in string with binary chr data
-            return false;
-        }
+const char *mapper_name(uint16_t mapper) {
+    switch (mapper) {
+        case 0: return "NROM";
+        case 1: return "MMC1";
+        case 2: return "UxROM";
+        case 3: return "CNROM";
+        case 4: return "MMC3";
+        case 5: return "MMC5";
+        case 7: return "AxROM";
+        case 9: return "MMC2";
+        case 10: return "MMC4";
+        case 11: return "Color Dreams";
+        case 66: return "GxROM";
+        case 69: return "FME-7";
+        default: return "other";
+    }
+}
+
+// reads the whole file in one go and parses it from memory
+ROM_STATUS parse_rom(FILE *rom_file, ROM *rom) {
+    if (rom_file == NULL || fseek(rom_file, 0, SEEK_END) != 0) {
+        return ROM_UNREADABLE;
+    }
+    long size = ftell(rom_file);
+    if (size < 0 || fseek(rom_file, 0, SEEK_SET) != 0) {
+        return ROM_UNREADABLE;
     }
-    rom->chr[chr_length] = '\0'; // null-terminate data
 
-    rom->prg_len = prg_length;
-    rom->chr_len = chr_length;
+    uint8_t *data = (uint8_t*) malloc(size ? size : 1);
+    ROM_STATUS status = fread(data, 1, size, rom_file) == (size_t) size ? parse_rom_memory(data, size, rom) : ROM_UNREADABLE;
+    free(data);
+    return status;
+}
 
-    return true;
+// loads an image already in memory, data is copied so the caller keeps ownership
+ROM_STATUS parse_rom_memory(const uint8_t *data, size_t size, ROM *rom) {
+    ROMHeader header;
+    ROM_STATUS status = read_rom_header(data, size, &header);
+    if (status != ROM_OK) {
+        return status;
+    }
+    rom->vertical_mirroring = header.vertical_mirroring;
+    rom->mapper = header.mapper;
+
+    rom->prg = (uint8_t*) calloc(header.prg_len + 1, sizeof(uint8_t)); // null-terminated
+    rom->chr = (uint8_t*) calloc(header.chr_len + 1, sizeof(uint8_t));
+    memcpy(rom->prg, data + header.prg_start, header.prg_len);
+    memcpy(rom->chr, data + header.prg_start + header.prg_len, header.chr_len);
+
+    rom->prg_len = header.prg_len;
+    rom->chr_len = header.chr_len;
+    return ROM_OK;
 }
 
 void close_rom(ROM *rom) {
     free(rom->prg);
     free(rom->chr);
-    for (unsigned i = 0; i < rom->inst_amount; i++) {
-        free(rom->prg_inst[i].body);
+    unload_native(rom);
+    if (rom->analysis) {
+        delete_analysis(rom->analysis);
+    }
+    if (rom->cache_map) { // decoded tables live in the mapping
+        munmap(rom->cache_map, rom->cache_size);
+    } else {
+        free(rom->prg_inst);
+        free(rom->chr_pixels);
     }
-    free(rom->prg_inst);
     free(rom);
 }
+
+// private copy of the tables emulation reads, allocated and written by the calling thread so they land on
+// its numa node, the recompiled blocks stay shared and the copy must be closed before the original
+ROM *replicate_rom(const ROM *rom) {
+    ROM *replica = (ROM*) calloc(1, sizeof(ROM));
+    *replica = *rom;
+    replica->path = NULL;
+    replica->analysis = NULL;
+    replica->cache_map = NULL;
+    replica->native_plugin = NULL;
+    replica->prg = (uint8_t*) calloc(rom->prg_len + 1, sizeof(uint8_t));
+    memcpy(replica->prg, rom->prg, rom->prg_len);
+    replica->chr = (uint8_t*) calloc(rom->chr_len + 1, sizeof(uint8_t));
+    memcpy(replica->chr, rom->chr, rom->chr_len);
+    replica->prg_inst = (Inst*) malloc(rom->inst_amount * sizeof(Inst));
+    memcpy(replica->prg_inst, rom->prg_inst, rom->inst_amount * sizeof(Inst));
+    if (rom->chr_pixels) {
+        replica->chr_pixels = (uint8_t*) calloc((size_t) rom->chr_len * 4 + 1, 1);
+        memcpy(replica->chr_pixels, rom->chr_pixels, (size_t) rom->chr_len * 4);
+    }
+    if (rom->native) {
+        replica->native = (const NativeBlock**) malloc(rom->prg_len * sizeof(NativeBlock*));
+        memcpy(replica->native, rom->native, rom->prg_len * sizeof(NativeBlock*));
+    }
+    return replica;
+}
+
+// offset into prg of a cpu address in $8000-$ffff, 16 KiB images are mirrored
+unsigned prg_offset(const ROM *rom, uint16_t addr) {
+    return (addr - PRG_ROM_START) % rom->prg_len;
+}
+
+uint8_t read_prg(const ROM *rom, uint16_t addr) {
+    if (!rom->prg_len) {
+        return 0;
+    }
+    return rom->prg[prg_offset(rom, addr)];
+}
+
+// cpu address of a prg offset in the top mirror, where the vectors live
+// only inverts prg_offset while prg fits the window, larger prg has offsets no address reaches
+uint16_t prg_address(const ROM *rom, unsigned offset) {
+    return 0x10000 - rom->prg_len + offset;
+}
+
+// identifies rom contents for caches derived from them
+uint64_t rom_hash(const ROM *rom) {
+    return hash64(rom->chr, rom->chr_len, hash64(rom->prg, rom->prg_len, 0));
+}
+
+// expands the two bit planes of every chr tile so the renderer reads a pixel with one load
+void decode_chr(ROM *rom) {
+    rom->chr_pixels = (uint8_t*) calloc((size_t) rom->chr_len * 4 + 1, 1);
+    for (unsigned addr = 0; addr < rom->chr_len; addr++) {
+        if (addr % 16 >= 8) { // high plane, folded in with its low plane row
+            continue;
+        }
+        uint8_t lo = rom->chr[addr];
+        uint8_t hi = rom->chr[addr + 8];
+        uint8_t *row = &rom->chr_pixels[(addr / 16) * 64 + (addr % 8) * 8];
+        for (unsigned col = 0; col < 8; col++) {
+            unsigned bit = 7 - col;
+            row[col] = (((hi >> bit) & 1) << 1) | ((lo >> bit) & 1);
+        }
+    }
+}
@@ -9,19 +9,70 @@
 #define PRG_BLOCK_SIZE 16384
 #define PRG_BLOCK_BEGIN_LOC 16
 #define CHR_LEN_BYTE_LOC 5
+#define FLAGS6_BYTE_LOC 6
+#define FLAGS7_BYTE_LOC 7
+#define INES_MAGIC "NES\x1a"
+#define TRAINER_SIZE 512
+#define PRG_ROM_START 0x8000
+#define PRG_WINDOW_SIZE 0x8000   // cpu addresses prg is mirrored across, all of it is visible up to this size
 #define CHR_BLOCK_SIZE 8192
 
+// why an image was rejected, ROM_OK is zero so results can be tested like a status code
+typedef enum ROM_STATUS {
+    ROM_OK = 0,
+    ROM_UNREADABLE,         // file could not be opened or read
+    ROM_BAD_MAGIC,          // not an ines image
+    ROM_NO_PRG,             // header declares no prg banks
+    ROM_TRUNCATED           // shorter than the header, trainer and banks it declares
+} ROM_STATUS;
+
+// fields of an ines header, readable without loading the image
+typedef struct ROMHeader {
+    unsigned prg_len;
+    unsigned chr_len;
+    unsigned prg_start;     // file offset of prg, after the header and any trainer
+    uint16_t mapper;
+    bool trainer;
+    bool nes2;              // nes 2.0 header
+    bool battery;
+    bool vertical_mirroring;
+    bool trailing_data;     // file is longer than the banks it declares
+} ROMHeader;
+
 typedef struct Inst Inst;
+typedef struct NativeBlock NativeBlock;
+typedef struct Analysis Analysis;
 
+// filled by parse_rom and parse_insts, then treated as read-only so that any
+// number of NES instances can share one decoded image
 typedef struct ROM {
     char *path;
     uint8_t *prg;
     unsigned prg_len;
     uint8_t *chr;
     unsigned chr_len;
+    bool vertical_mirroring;
+    uint16_t mapper;                // only nrom is emulated, other mappers run as if they were
     Inst *prg_inst;
     unsigned inst_amount;
+    uint8_t *chr_pixels;            // chr tiles decoded to one 2-bit pixel per byte, 64 per tile
+    Analysis *analysis;             // static control flow, NULL unless prepared
+    void *cache_map;                // decoded rom cache backing prg_inst, chr_pixels and analysis, if mapped
+    size_t cache_size;
+    bool cycle_stepped;             // listed as needing every bus access on its true cycle, runs on the slower core
+    const NativeBlock **native;     // recompiled block starting at each prg offset, NULL without a plugin
+    void *native_plugin;
 } ROM;
 
-bool parse_rom(FILE *rom_file, ROM *rom_path);
+ROM_STATUS read_rom_header(const uint8_t *data, size_t size, ROMHeader *header);
+const char *rom_status_name(ROM_STATUS status);
+const char *mapper_name(uint16_t mapper);
+ROM_STATUS parse_rom(FILE *rom_file, ROM *rom);
+ROM_STATUS parse_rom_memory(const uint8_t *data, size_t size, ROM *rom);
 void close_rom(ROM *rom);
+ROM *replicate_rom(const ROM *rom);
+uint8_t read_prg(const ROM *rom, uint16_t addr);
+unsigned prg_offset(const ROM *rom, uint16_t addr);
+uint16_t prg_address(const ROM *rom, unsigned offset);
+uint64_t rom_hash(const ROM *rom);
+void decode_chr(ROM *rom);
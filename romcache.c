@@ -0,0 +1,177 @@
+#include "romcache.h"
+#include "cycle.h"
+#include "analysis.h"
+#include "hash.h"
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static uint64_t align_up(uint64_t offset) {
+    return (offset + ROM_CACHE_ALIGN - 1) / ROM_CACHE_ALIGN * ROM_CACHE_ALIGN;
+}
+
+// section offsets for a rom, so reader and writer always agree
+static void layout(const ROM *rom, const Analysis *analysis, ROMCacheHeader *header) {
+    unsigned bitmap = (rom->prg_len + 7) / 8;
+    memset(header, 0, sizeof(ROMCacheHeader));
+    header->magic = ROM_CACHE_MAGIC;
+    header->version = ROM_CACHE_VERSION;
+    header->rom_hash = analysis->rom_hash;
+    header->prg_len = rom->prg_len;
+    header->chr_len = rom->chr_len;
+    header->inst_size = sizeof(Inst);
+    header->block_count = analysis->block_count;
+    header->table_count = analysis->table_count;
+    header->inst_offset = align_up(sizeof(ROMCacheHeader));
+    header->code_offset = align_up(header->inst_offset + (uint64_t) rom->prg_len * sizeof(Inst));
+    header->starts_offset = align_up(header->code_offset + bitmap);
+    header->blocks_offset = align_up(header->starts_offset + bitmap);
+    header->tables_offset = align_up(header->blocks_offset + (uint64_t) analysis->block_count * sizeof(Block));
+    header->chr_offset = align_up(header->tables_offset + (uint64_t) analysis->table_count * sizeof(JumpTable));
+    header->size = header->chr_offset + (uint64_t) rom->chr_len * 4;
+}
+
+// $XDG_CACHE_HOME/maxnes/<hash of prg and chr>.rom, falling back to ~/.cache, NULL if neither is set
+char *rom_cache_path(const ROM *rom) {
+    const char *base = getenv("XDG_CACHE_HOME");
+    const char *suffix = "";
+    if (!base || !*base) {
+        base = getenv("HOME");
+        suffix = "/.cache";
+    }
+    if (!base || !*base) {
+        return NULL;
+    }
+
+    char *path = (char*) malloc(strlen(base) + strlen(suffix) + sizeof("/maxnes/0123456789abcdef.rom"));
+    sprintf(path, "%s%s/maxnes/%016llx.rom", base, suffix, (unsigned long long) rom_hash(rom));
+    return path;
+}
+
+// points the rom's decoded tables into a read-only mapping of its cache file, returns false on any mismatch
+// or when the contents do not match the checksum, such as a file truncated or rewritten in place
+bool map_rom_cache(ROM *rom) {
+    char *path = rom_cache_path(rom);
+    int fd = path ? open(path, O_RDONLY) : -1;
+    free(path);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) < 0 || (size_t) info.st_size < sizeof(ROMCacheHeader)) {
+        close(fd);
+        return false;
+    }
+    uint8_t *map = (uint8_t*) mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+
+    const ROMCacheHeader *header = (const ROMCacheHeader*) map;
+    Analysis shape = {header->rom_hash, 0, NULL, NULL, NULL, header->block_count, NULL, header->table_count};
+    ROMCacheHeader expected;
+    layout(rom, &shape, &expected);
+    expected.checksum = header->checksum;
+    if (header->magic != ROM_CACHE_MAGIC || header->version != ROM_CACHE_VERSION || header->rom_hash != rom_hash(rom) ||
+            memcmp(header, &expected, sizeof(expected)) || header->size != (uint64_t) info.st_size ||
+            hash64(map + sizeof(ROMCacheHeader), header->size - sizeof(ROMCacheHeader), 0) != header->checksum) {
+        munmap(map, info.st_size);
+        return false;
+    }
+
+    Analysis *analysis = (Analysis*) calloc(1, sizeof(Analysis));
+    analysis->rom_hash = header->rom_hash;
+    analysis->prg_len = header->prg_len;
+    analysis->code = map + header->code_offset;
+    analysis->starts = map + header->starts_offset;
+    analysis->blocks = (Block*) (map + header->blocks_offset);
+    analysis->block_count = header->block_count;
+    analysis->tables = (JumpTable*) (map + header->tables_offset);
+    analysis->table_count = header->table_count;
+    analysis->mapped = true;
+
+    rom->prg_inst = (Inst*) (map + header->inst_offset);
+    rom->inst_amount = rom->prg_len;
+    rom->chr_pixels = rom->chr_len ? map + header->chr_offset : NULL;
+    rom->analysis = analysis;
+    rom->cache_map = map;
+    rom->cache_size = info.st_size;
+    return true;
+}
+
+// writes the decoded tables through a uniquely named temporary file renamed into place, so readers never map a
+// partial cache and concurrent writers of the same rom never share a temporary
+bool write_rom_cache(const ROM *rom) {
+    char *path = rom_cache_path(rom);
+    if (!path) {
+        return false;
+    }
+    char *dir = strdup(path);
+    *strrchr(dir, '/') = '\0';
+    *strrchr(dir, '/') = '\0';
+    mkdir(dir, 0755); // cache base may not exist yet
+    sprintf(dir + strlen(dir), "/maxnes");
+    mkdir(dir, 0755);
+    free(dir);
+
+    const Analysis *analysis = rom->analysis;
+    unsigned bitmap = (rom->prg_len + 7) / 8;
+    ROMCacheHeader header;
+    layout(rom, analysis, &header);
+    uint8_t *image = (uint8_t*) calloc(1, header.size); // padding between sections stays zero
+    memcpy(image + header.inst_offset, rom->prg_inst, (size_t) rom->prg_len * sizeof(Inst));
+    memcpy(image + header.code_offset, analysis->code, bitmap);
+    memcpy(image + header.starts_offset, analysis->starts, bitmap);
+    memcpy(image + header.blocks_offset, analysis->blocks, analysis->block_count * sizeof(Block));
+    memcpy(image + header.tables_offset, analysis->tables, analysis->table_count * sizeof(JumpTable));
+    if (rom->chr_len) {
+        memcpy(image + header.chr_offset, rom->chr_pixels, (size_t) rom->chr_len * 4);
+    }
+    header.checksum = hash64(image + sizeof(header), header.size - sizeof(header), 0);
+    memcpy(image, &header, sizeof(header));
+
+    char *temp = (char*) malloc(strlen(path) + sizeof(".XXXXXX"));
+    sprintf(temp, "%s.XXXXXX", path);
+    int fd = mkstemp(temp);
+    FILE *file = fd < 0 ? NULL : fdopen(fd, "wb");
+    if (!file) {
+        if (fd >= 0) {
+            close(fd);
+            unlink(temp);
+        }
+        free(image);
+        free(temp);
+        free(path);
+        return false;
+    }
+
+    fchmod(fd, 0644); // mkstemp creates it private to the user
+    bool complete = fwrite(image, header.size, 1, file) == 1;
+    complete = fclose(file) == 0 && complete && rename(temp, path) == 0;
+    if (!complete) {
+        unlink(temp);
+    }
+    free(image);
+    free(temp);
+    free(path);
+    return complete;
+}
+
+// fills the decoded instruction table, chr pixels and analysis of a freshly parsed rom,
+// mapping them from the cache when a previous run left one and writing one otherwise,
+// and picks the cpu core from the accuracy database
+void prepare_rom(ROM *rom) {
+    rom->cycle_stepped = needs_cycle_stepping(rom);
+    if (map_rom_cache(rom)) {
+        return;
+    }
+    parse_insts(rom);
+    decode_chr(rom);
+    rom->analysis = analyze_rom(rom);
+    write_rom_cache(rom); // best effort, an unwritable cache only costs the next start its decode
+}
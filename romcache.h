@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "rom.h"
+
+#define ROM_CACHE_MAGIC 0x43584e4d // "MNXC"
+#define ROM_CACHE_VERSION 3
+#define ROM_CACHE_ALIGN 64
+
+// cache file layout: this header, then each section at its offset, aligned for direct use from the mapping
+typedef struct ROMCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t rom_hash;
+    uint32_t prg_len;
+    uint32_t chr_len;
+    uint32_t inst_size;         // sizeof(Inst) of the writing build, decoded instructions are stored verbatim
+    uint32_t block_count;
+    uint32_t table_count;
+    uint32_t reserved;
+    uint64_t inst_offset;       // prg_len decoded instructions
+    uint64_t code_offset;       // code bitmap
+    uint64_t starts_offset;     // instruction start bitmap
+    uint64_t blocks_offset;
+    uint64_t tables_offset;
+    uint64_t chr_offset;        // chr_len * 4 pixels
+    uint64_t size;
+    uint64_t checksum;          // hash64 of everything after the header, checked on every map
+} ROMCacheHeader;
+
+char *rom_cache_path(const ROM *rom);
+bool map_rom_cache(ROM *rom);
+bool write_rom_cache(const ROM *rom);
+void prepare_rom(ROM *rom);
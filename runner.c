@@ -0,0 +1,113 @@
+#include "runner.h"
+#include "nes.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+// workers are pinned one per cpu in topology order, each builds and runs only its own consoles so their
+// state stays in that core's caches and on its node, and reads a copy of the rom local to its node
+typedef struct Runner {
+    const ROM *rom;
+    const Topology *topology;
+    unsigned workers;
+    unsigned instances;
+    unsigned frames;
+    ROM **replicas;             // per node, only when there is more than one
+    pthread_barrier_t replicated;
+    pthread_barrier_t built;    // also joined by the timing thread
+    pthread_barrier_t finished;
+} Runner;
+
+typedef struct RunnerWorker {
+    Runner *runner;
+    unsigned index;
+    pthread_t thread;
+} RunnerWorker;
+
+static void *worker_main(void *arg) {
+    RunnerWorker *worker = (RunnerWorker*) arg;
+    Runner *runner = worker->runner;
+    const Topology *topology = runner->topology;
+    unsigned node = topology->cpu_nodes[worker->index];
+    pin_thread(topology->cpus[worker->index]);
+
+    bool first_on_node = worker->index == 0 || topology->cpu_nodes[worker->index - 1] != node;
+    if (runner->replicas && first_on_node) {
+        runner->replicas[node] = replicate_rom(runner->rom);
+    }
+    pthread_barrier_wait(&runner->replicated);
+    const ROM *rom = runner->replicas ? runner->replicas[node] : runner->rom;
+
+    unsigned count = runner->instances / runner->workers + (worker->index < runner->instances % runner->workers);
+    NES **consoles = (NES**) calloc(count ? count : 1, sizeof(NES*));
+    for (unsigned i = 0; i < count; i++) {
+        consoles[i] = new_NES(rom); // first touched here, on this node
+    }
+    pthread_barrier_wait(&runner->built);
+
+    for (unsigned frame = 0; frame < runner->frames; frame++) {
+        for (unsigned i = 0; i < count; i++) {
+            run_frame(consoles[i]);
+        }
+    }
+    pthread_barrier_wait(&runner->finished);
+
+    for (unsigned i = 0; i < count; i++) {
+        delete_nes(consoles[i]);
+    }
+    free(consoles);
+    return NULL;
+}
+
+static double seconds_now(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+// runs fresh consoles for frames frames each, spread over one pinned worker on each of the first workers cpus
+RunnerStats run_pinned(const ROM *rom, const Topology *topology, unsigned workers, unsigned instances, unsigned frames) {
+    Runner runner = {rom, topology, workers, instances, frames, NULL};
+    if (runner.workers > topology->cpu_count) {
+        runner.workers = topology->cpu_count;
+    }
+    if (runner.workers == 0) {
+        runner.workers = 1;
+    }
+    if (topology->node_count > 1) {
+        runner.replicas = (ROM**) calloc(topology->node_count, sizeof(ROM*));
+    }
+    pthread_barrier_init(&runner.replicated, NULL, runner.workers);
+    pthread_barrier_init(&runner.built, NULL, runner.workers + 1);
+    pthread_barrier_init(&runner.finished, NULL, runner.workers + 1);
+
+    RunnerWorker *pool = (RunnerWorker*) calloc(runner.workers, sizeof(RunnerWorker));
+    for (unsigned i = 0; i < runner.workers; i++) {
+        pool[i].runner = &runner;
+        pool[i].index = i;
+        pthread_create(&pool[i].thread, NULL, worker_main, &pool[i]);
+    }
+    pthread_barrier_wait(&runner.built);
+    double start = seconds_now();
+    pthread_barrier_wait(&runner.finished);
+    double end = seconds_now();
+    for (unsigned i = 0; i < runner.workers; i++) {
+        pthread_join(pool[i].thread, NULL);
+    }
+
+    if (runner.replicas) {
+        for (unsigned node = 0; node < topology->node_count; node++) {
+            if (runner.replicas[node]) {
+                close_rom(runner.replicas[node]);
+            }
+        }
+        free(runner.replicas);
+    }
+    pthread_barrier_destroy(&runner.replicated);
+    pthread_barrier_destroy(&runner.built);
+    pthread_barrier_destroy(&runner.finished);
+    free(pool);
+
+    RunnerStats stats = {runner.workers, instances, (uint64_t) instances * frames, end - start};
+    return stats;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stdint.h>
+#include "rom.h"
+#include "topology.h"
+
+typedef struct RunnerStats {
+    unsigned workers;
+    unsigned instances;
+    uint64_t frames;        // across all instances
+    double seconds;         // wall time of the frames alone, setup and teardown excluded
+} RunnerStats;
+
+RunnerStats run_pinned(const ROM *rom, const Topology *topology, unsigned workers, unsigned instances, unsigned frames);
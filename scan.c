@@ -0,0 +1,150 @@
+#include "scan.h"
+#include "hash.h"
+#include "threadpool.h"
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+typedef struct PathList {
+    char **paths;
+    unsigned count;
+    unsigned capacity;
+} PathList;
+
+static bool is_rom_name(const char *name) {
+    size_t len = strlen(name);
+    return len > 4 && !strcasecmp(name + len - 4, ".nes");
+}
+
+// collects .nes files below dir/relative, depth first
+static void collect_roms(const char *dir, const char *relative, PathList *list) {
+    char *path = (char*) malloc(strlen(dir) + strlen(relative) + 2);
+    sprintf(path, "%s%s%s", dir, *relative ? "/" : "", relative);
+    DIR *handle = opendir(path);
+    free(path);
+    if (handle == NULL) {
+        return;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(handle)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        char *child = (char*) malloc(strlen(relative) + strlen(entry->d_name) + 2);
+        sprintf(child, "%s%s%s", relative, *relative ? "/" : "", entry->d_name);
+
+        if (entry->d_type == DT_DIR) {
+            collect_roms(dir, child, list);
+            free(child);
+        } else if ((entry->d_type == DT_REG || entry->d_type == DT_LNK || entry->d_type == DT_UNKNOWN) &&
+                is_rom_name(entry->d_name)) {
+            if (list->count == list->capacity) {
+                list->capacity = list->capacity ? list->capacity * 2 : 256;
+                list->paths = (char**) realloc(list->paths, list->capacity * sizeof(char*));
+            }
+            list->paths[list->count++] = child;
+        } else {
+            free(child);
+        }
+    }
+    closedir(handle);
+}
+
+// validates and hashes one file straight from its mapping, no copies
+static void scan_rom(void *context, unsigned index) {
+    ROMLibrary *library = (ROMLibrary*) context;
+    ROMIndexEntry *entry = &library->entries[index];
+    char *path = (char*) malloc(strlen(library->dir) + strlen(library->paths[index]) + 2);
+    sprintf(path, "%s/%s", library->dir, library->paths[index]);
+    int fd = open(path, O_RDONLY);
+    free(path);
+
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) < 0) {
+        entry->status = ROM_UNREADABLE;
+        if (fd >= 0) {
+            close(fd);
+        }
+        return;
+    }
+    entry->file_size = info.st_size;
+
+    const uint8_t *data = NULL;
+    if (info.st_size > 0) {
+        data = (const uint8_t*) mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (data == MAP_FAILED) {
+        entry->status = ROM_UNREADABLE;
+        return;
+    }
+
+    ROMHeader header;
+    entry->status = read_rom_header(data ? data : (const uint8_t*) "", info.st_size, &header);
+    entry->mapper = header.mapper;
+    entry->prg_len = header.prg_len;
+    entry->chr_len = header.chr_len;
+    entry->flags = (header.trainer ? INDEX_TRAINER : 0) | (header.nes2 ? INDEX_NES2 : 0) |
+        (header.battery ? INDEX_BATTERY : 0) | (header.vertical_mirroring ? INDEX_VERTICAL_MIRRORING : 0) |
+        (header.trailing_data ? INDEX_TRAILING_DATA : 0);
+    if (entry->status == ROM_OK) { // same hashes rom_hash chains, so index entries match decoded rom caches
+        entry->prg_hash = hash64(data + header.prg_start, header.prg_len, 0);
+        entry->chr_hash = hash64(data + header.prg_start + header.prg_len, header.chr_len, entry->prg_hash);
+    }
+    if (data) {
+        munmap((void*) data, info.st_size);
+    }
+}
+
+// finds every .nes file below dir and checks them across threads, threads counts the caller
+ROMLibrary *scan_roms(const char *dir, unsigned threads) {
+    PathList list = {0};
+    collect_roms(dir, "", &list);
+
+    ROMLibrary *library = (ROMLibrary*) calloc(1, sizeof(ROMLibrary));
+    library->dir = dir;
+    library->paths = list.paths;
+    library->count = list.count;
+    library->entries = (ROMIndexEntry*) calloc(list.count + 1, sizeof(ROMIndexEntry));
+
+    ThreadPool *pool = new_thread_pool(threads);
+    run_parallel(pool, library->count, scan_rom, library);
+    delete_thread_pool(pool);
+    return library;
+}
+
+bool write_rom_index(const ROMLibrary *library, const char *path) {
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        return false;
+    }
+
+    uint32_t strings_size = 0;
+    for (unsigned i = 0; i < library->count; i++) {
+        library->entries[i].path_offset = strings_size;
+        strings_size += strlen(library->paths[i]) + 1;
+    }
+
+    ROMIndexHeader header = {ROM_INDEX_MAGIC, ROM_INDEX_VERSION, library->count, strings_size};
+    bool complete = fwrite(&header, sizeof(header), 1, file) == 1 &&
+        fwrite(library->entries, sizeof(ROMIndexEntry), library->count, file) == library->count;
+    for (unsigned i = 0; i < library->count && complete; i++) {
+        complete = fwrite(library->paths[i], strlen(library->paths[i]) + 1, 1, file) == 1;
+    }
+    return fclose(file) == 0 && complete;
+}
+
+void delete_rom_library(ROMLibrary *library) {
+    for (unsigned i = 0; i < library->count; i++) {
+        free(library->paths[i]);
+    }
+    free(library->paths);
+    free(library->entries);
+    free(library);
+}
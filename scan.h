@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "rom.h"
+
+#define ROM_INDEX_MAGIC 0x49584e4d // "MNXI"
+#define ROM_INDEX_VERSION 1
+
+typedef enum ROM_INDEX_FLAG {
+    INDEX_TRAINER = 1,
+    INDEX_NES2 = 2,
+    INDEX_BATTERY = 4,
+    INDEX_VERTICAL_MIRRORING = 8,
+    INDEX_TRAILING_DATA = 16
+} ROM_INDEX_FLAG;
+
+// one scanned file, hashes are zero unless the header validated
+typedef struct ROMIndexEntry {
+    uint64_t prg_hash;
+    uint64_t chr_hash;
+    uint64_t file_size;
+    uint32_t prg_len;
+    uint32_t chr_len;
+    uint32_t path_offset;   // into the string table, relative to the scanned directory
+    uint16_t mapper;
+    uint8_t status;         // ROM_STATUS
+    uint8_t flags;          // ROM_INDEX_FLAG bits
+} ROMIndexEntry;
+
+// index file: this header, count entries, then strings_size bytes of nul-terminated paths
+typedef struct ROMIndexHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count;
+    uint32_t strings_size;
+} ROMIndexHeader;
+
+typedef struct ROMLibrary {
+    const char *dir;
+    char **paths;           // relative to dir
+    ROMIndexEntry *entries;
+    unsigned count;
+} ROMLibrary;
+
+ROMLibrary *scan_roms(const char *dir, unsigned threads);
+bool write_rom_index(const ROMLibrary *library, const char *path);
+void delete_rom_library(ROMLibrary *library);
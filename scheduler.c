@@ -0,0 +1,23 @@
+#include "scheduler.h"
+
+void reset_scheduler(Scheduler *sched) {
+    for (unsigned i = 0; i < COMPONENT_COUNT; i++) {
+        sched->clocks[i] = NO_EVENT;
+    }
+}
+
+// earliest clock wins, ties go to the component listed first
+COMPONENT furthest_behind(const Scheduler *sched) {
+    COMPONENT behind = 0;
+    for (unsigned i = 1; i < COMPONENT_COUNT; i++) {
+        if (sched->clocks[i] < sched->clocks[behind]) {
+            behind = i;
+        }
+    }
+    return behind;
+}
+
+// the cpu may run up to here before another component must catch up
+uint64_t next_sync_time(const Scheduler *sched) {
+    return sched->clocks[furthest_behind(sched)];
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define NO_EVENT UINT64_MAX
+
+// chips besides the cpu are hand-rolled state machines resumed at fixed points they schedule themselves,
+// each one resumed yields the cpu cycle of its next such point; the ppu additionally draws the scanlines
+// the cpu has passed whenever one of its registers is accessed
+typedef enum COMPONENT {
+    COMPONENT_PPU,      // finishes the frame and enters vertical blank, raises nmi, leaves vertical blank
+    COMPONENT_APU,      // frame counter reaches end of 4-step sequence
+    COMPONENT_DMA,      // $4014 write copies a page to sprite memory and stalls cpu
+    COMPONENT_COUNT
+} COMPONENT;
+
+// master clock of every component in cpu cycles, the cpu's own is its cycle counter
+typedef struct Scheduler {
+    uint64_t clocks[COMPONENT_COUNT];   // cycle the component has run up to and next resumes at, NO_EVENT while dormant
+} Scheduler;
+
+void reset_scheduler(Scheduler *sched);
+COMPONENT furthest_behind(const Scheduler *sched);
+uint64_t next_sync_time(const Scheduler *sched);
@@ -0,0 +1,176 @@
+#include "nes.h"
+#include "pool.h"
+#include "wide.h"
+#include "hash.h"
+#include "romcache.h"
+#include "palette.h"
+#include <stdio.h>
+#include <string.h>
+
+// consistency checks run by make check: state snapshots, pooled consoles and lockstep lanes must all
+// reproduce what a fresh console running the same inputs does, and the vector palette conversions
+// what a single table lookup gives
+// usage: check <rom> <movie>
+
+#define CHECK_FRAMES 120
+#define CHECK_LANES 19 // a whole vector of lanes and a scalar tail
+
+static unsigned failures;
+
+static void expect(bool condition, const char *what) {
+    if (!condition) {
+        printf("FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+static bool same_frame(const NES *a, const NES *b) {
+    FrameHash hash_a;
+    FrameHash hash_b;
+    hash_frame(a, &hash_a);
+    hash_frame(b, &hash_b);
+    return !memcmp(&hash_a, &hash_b, sizeof(hash_a)) && a->cpu.insts == b->cpu.insts;
+}
+
+// a chain of deltas applied to a fresh console reproduces the running one after every frame
+static void check_deltas(const ROM *rom, const uint8_t *movie, unsigned frames) {
+    NES *nes = new_NES(rom);
+    NES *replica = new_NES(rom);
+    uint8_t *delta = (uint8_t*) malloc(nes_delta_max_size());
+    uint8_t *state = (uint8_t*) malloc(nes_state_size());
+    uint8_t *replica_state = (uint8_t*) malloc(nes_state_size());
+    bool matched = true;
+    for (unsigned i = 0; i < frames; i++) {
+        nes->controllers[0].buttons = movie[i];
+        run_frame(nes);
+        size_t size = save_nes_delta(nes, delta);
+        matched = matched && load_nes_delta(replica, delta, size);
+        save_nes_state(nes, state);
+        save_nes_state(replica, replica_state);
+        matched = matched && !memcmp(state, replica_state, nes_state_size());
+    }
+    expect(matched, "delta chain reproduces the console");
+
+    load_nes_state(replica, state); // a full snapshot restores the same state and continues identically
+    nes->controllers[0].buttons = replica->controllers[0].buttons = 0x81;
+    run_frame(nes);
+    run_frame(replica);
+    expect(same_frame(nes, replica), "state round trip continues identically");
+
+    free(delta);
+    free(state);
+    free(replica_state);
+    delete_nes(nes);
+    delete_nes(replica);
+}
+
+// a released console comes back identical to a fresh one, wherever it was stopped
+static void check_pool(const ROM *rom, const uint8_t *movie) {
+    NESPool *pool = new_nes_pool(rom, 1);
+    NES *fresh = new_NES(rom);
+    bool matched = true;
+    for (unsigned run = 0; run < 6; run++) {
+        NES *nes = acquire_nes(pool);
+        for (unsigned i = 0; i < run / 2; i++) {
+            nes->controllers[0].buttons = movie[i];
+            run_frame(nes);
+        }
+        if (run % 2) { // stop mid-frame with scanlines already drawn
+            run_nes(nes, nes->cpu.cycles + 15000);
+        }
+        release_nes(pool, nes);
+        nes = acquire_nes(pool);
+        matched = matched && !memcmp(nes, fresh, sizeof(NES));
+        release_nes(pool, nes);
+    }
+    expect(matched, "recycled console matches a fresh one");
+    delete_nes(fresh);
+    delete_nes_pool(pool);
+}
+
+// lockstep lanes holding different buttons end every frame where independent consoles do
+static void check_wide(const ROM *rom, unsigned frames) {
+    WideNES *wide = new_wide(rom, CHECK_LANES);
+    NES *independent[CHECK_LANES];
+    for (unsigned i = 0; i < CHECK_LANES; i++) {
+        independent[i] = new_NES(rom);
+        independent[i]->controllers[0].buttons = wide->nes[i]->controllers[0].buttons = (uint8_t) (i * 37);
+    }
+    bool matched = true;
+    for (unsigned f = 0; f < frames; f++) {
+        run_wide_frame(wide);
+        for (unsigned i = 0; i < CHECK_LANES; i++) {
+            run_frame(independent[i]);
+            matched = matched && same_frame(wide->nes[i], independent[i]);
+        }
+    }
+    expect(matched, "lockstep lanes match independent consoles");
+    expect(wide->matched_steps > 0 && wide->matched_steps < wide->lane_steps, "lanes both share and diverge");
+    for (unsigned i = 0; i < CHECK_LANES; i++) {
+        delete_nes(independent[i]);
+    }
+    delete_wide(wide);
+}
+
+// every byte value through the conversions, which take the shuffle kernels on ssse3 machines, against
+// the per-index lookups; the second pass starts one byte in so that it ends in a scalar tail
+static void check_palette() {
+    uint8_t indices[256];
+    uint8_t gray[256];
+    uint32_t rgb[256];
+    for (unsigned i = 0; i < sizeof(indices); i++) {
+        indices[i] = i;
+    }
+    bool gray_matched = true;
+    bool rgb_matched = true;
+    for (unsigned start = 0; start < 2; start++) {
+        unsigned count = sizeof(indices) - start;
+        palette_to_gray(indices + start, count, gray);
+        for (unsigned i = 0; i < count; i++) {
+            gray_matched = gray_matched && gray[i] == palette_luma(indices[start + i]);
+        }
+        for (unsigned emphasis = 0; emphasis < 8; emphasis++) {
+            palette_to_rgb(indices + start, count, emphasis, rgb);
+            for (unsigned i = 0; i < count; i++) {
+                rgb_matched = rgb_matched && rgb[i] == palette_rgb(indices[start + i], emphasis);
+            }
+        }
+    }
+    expect(gray_matched, "gray conversion matches palette_luma");
+    expect(rgb_matched, "rgb conversion matches palette_rgb");
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: check <rom> <movie>\n");
+        return -1;
+    }
+    FILE *rom_file = fopen(argv[1], "rb");
+    FILE *movie_file = fopen(argv[2], "rb");
+    if (rom_file == NULL || movie_file == NULL) {
+        fprintf(stderr, "Error: unable to open file\n");
+        return -1;
+    }
+    uint8_t movie[CHECK_FRAMES] = {0};
+    fread(movie, 1, CHECK_FRAMES, movie_file);
+    fclose(movie_file);
+
+    ROM *rom = (ROM*) calloc(1, sizeof(ROM));
+    ROM_STATUS status = parse_rom(rom_file, rom);
+    fclose(rom_file);
+    if (status != ROM_OK) {
+        fprintf(stderr, "Error: rom %s\n", rom_status_name(status));
+        close_rom(rom);
+        return -1;
+    }
+    prepare_rom(rom);
+
+    check_deltas(rom, movie, CHECK_FRAMES);
+    check_pool(rom, movie);
+    check_wide(rom, CHECK_FRAMES);
+    check_palette();
+
+    close_rom(rom);
+    printf("%s\n", failures ? "check failed" : "check passed");
+    return failures ? 1 : 0;
+}
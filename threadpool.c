@@ -0,0 +1,91 @@
+#include "threadpool.h"
+#include <stdlib.h>
+
+// claims indices one at a time until the job is exhausted
+static void drain_job(ThreadPool *pool) {
+    for (;;) {
+        unsigned index = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED);
+        if (index >= pool->count) {
+            return;
+        }
+        pool->task(pool->context, index);
+    }
+}
+
+static void *worker_main(void *arg) {
+    ThreadPool *pool = (ThreadPool*) arg;
+    unsigned seen = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (pool->generation == seen && !pool->stopping) {
+            pthread_cond_wait(&pool->job_ready, &pool->lock);
+        }
+        if (pool->stopping) {
+            break;
+        }
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        drain_job(pool);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->busy == 0) {
+            pthread_cond_signal(&pool->job_done);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+// threads counts the calling thread, so a pool of 1 runs everything inline
+ThreadPool *new_thread_pool(unsigned threads) {
+    ThreadPool *pool = (ThreadPool*) calloc(1, sizeof(ThreadPool));
+    pool->threads = threads ? threads : 1;
+    pool->workers = (pthread_t*) calloc(pool->threads, sizeof(pthread_t));
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->job_ready, NULL);
+    pthread_cond_init(&pool->job_done, NULL);
+    for (unsigned i = 1; i < pool->threads; i++) {
+        pthread_create(&pool->workers[i], NULL, worker_main, pool);
+    }
+
+    return pool;
+}
+
+void delete_thread_pool(ThreadPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->job_ready);
+    pthread_mutex_unlock(&pool->lock);
+    for (unsigned i = 1; i < pool->threads; i++) {
+        pthread_join(pool->workers[i], NULL);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->job_ready);
+    pthread_cond_destroy(&pool->job_done);
+    free(pool->workers);
+    free(pool);
+}
+
+// calls task(context, i) for every i below count across the pool, returns once all calls finished
+void run_parallel(ThreadPool *pool, unsigned count, ParallelTask task, void *context) {
+    pthread_mutex_lock(&pool->lock);
+    pool->task = task;
+    pool->context = context;
+    pool->count = count;
+    pool->next = 0;
+    pool->busy = pool->threads - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->job_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    drain_job(pool);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->busy) {
+        pthread_cond_wait(&pool->job_done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
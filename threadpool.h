@@ -0,0 +1,26 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+
+typedef void (*ParallelTask)(void *context, unsigned index);
+
+// fixed set of worker threads executing index-parallel jobs, the calling thread joins in
+typedef struct ThreadPool {
+    unsigned threads;
+    pthread_t *workers;
+    pthread_mutex_t lock;
+    pthread_cond_t job_ready;
+    pthread_cond_t job_done;
+    unsigned generation;        // incremented per job so sleeping workers notice new work
+    unsigned busy;              // workers still inside the current job
+    bool stopping;
+    ParallelTask task;
+    void *context;
+    unsigned count;
+    unsigned next;              // next index to claim, shared by all threads
+} ThreadPool;
+
+ThreadPool *new_thread_pool(unsigned threads);
+void delete_thread_pool(ThreadPool *pool);
+void run_parallel(ThreadPool *pool, unsigned count, ParallelTask task, void *context);
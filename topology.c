@@ -0,0 +1,82 @@
+#define _GNU_SOURCE
+#include "topology.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <pthread.h>
+
+#define MAX_NODES 64
+
+// marks every cpu in a sysfs list such as "0-3,8-11" in nodes
+static void read_cpu_list(const char *path, unsigned node, unsigned *nodes) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return;
+    }
+    unsigned first;
+    while (fscanf(file, "%u", &first) == 1) {
+        unsigned last = first;
+        int separator = fgetc(file);
+        if (separator == '-') {
+            if (fscanf(file, "%u", &last) != 1) {
+                break;
+            }
+            separator = fgetc(file);
+        }
+        for (unsigned cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) {
+            nodes[cpu] = node;
+        }
+        if (separator != ',') {
+            break;
+        }
+    }
+    fclose(file);
+}
+
+// machines without numa sysfs entries are treated as a single node
+Topology *read_topology(void) {
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed)) {
+        CPU_ZERO(&allowed);
+        CPU_SET(0, &allowed);
+    }
+
+    unsigned nodes[CPU_SETSIZE];
+    for (unsigned cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        nodes[cpu] = 0;
+    }
+    char path[64];
+    for (unsigned node = 0; node < MAX_NODES; node++) {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%u/cpulist", node);
+        read_cpu_list(path, node, nodes);
+    }
+
+    Topology *topology = (Topology*) calloc(1, sizeof(Topology));
+    topology->cpus = (unsigned*) calloc(CPU_COUNT(&allowed), sizeof(unsigned));
+    topology->cpu_nodes = (unsigned*) calloc(CPU_COUNT(&allowed), sizeof(unsigned));
+    for (unsigned node = 0; node < MAX_NODES; node++) {
+        for (unsigned cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &allowed) && nodes[cpu] == node) {
+                topology->cpus[topology->cpu_count] = cpu;
+                topology->cpu_nodes[topology->cpu_count] = node;
+                topology->cpu_count++;
+                topology->node_count = node + 1;
+            }
+        }
+    }
+    return topology;
+}
+
+void delete_topology(Topology *topology) {
+    free(topology->cpus);
+    free(topology->cpu_nodes);
+    free(topology);
+}
+
+// binds the calling thread to one cpu, memory it touches first is then allocated on that cpu's node
+bool pin_thread(unsigned cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
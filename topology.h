@@ -0,0 +1,15 @@
+#pragma once
+
+#include <stdbool.h>
+
+// cpus this process may run on, grouped by numa node
+typedef struct Topology {
+    unsigned cpu_count;
+    unsigned *cpus;         // sorted by node, so a prefix fills one node before spilling onto the next
+    unsigned *cpu_nodes;    // node of each entry in cpus
+    unsigned node_count;    // one past the highest node id
+} Topology;
+
+Topology *read_topology(void);
+void delete_topology(Topology *topology);
+bool pin_thread(unsigned cpu);
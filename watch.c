@@ -0,0 +1,126 @@
+#include "watch.h"
+#include "nes.h"
+#include <stdlib.h>
+#include <string.h>
+
+// sets the kinds watched at one address, adding its page to the table or dropping the page with its last watch
+static void watch_address(NES *nes, uint16_t addr, uint8_t kinds) {
+    Watches *watches = nes->watches;
+    uint8_t index = addr >> 8;
+    WatchPage *page = watches->pages[index];
+    if (!page) {
+        if (!kinds) {
+            return;
+        }
+        page = (WatchPage*) calloc(1, sizeof(WatchPage));
+        const uint8_t *memory = direct_page(nes, index);
+        if (memory) {
+            memcpy(page->last, memory, sizeof(page->last));
+        }
+        watches->pages[index] = page;
+        watches->page_count++;
+        watches->ram_pages += addr <= 0x1fff;
+    }
+
+    uint8_t *entry = &page->kinds[addr & 0xff];
+    page->watched += (kinds != 0) - (*entry != 0);
+    watches->read_watches += ((kinds & WATCH_READ) != 0) - ((*entry & WATCH_READ) != 0);
+    *entry = kinds;
+
+    if (!page->watched) {
+        free(page);
+        watches->pages[index] = NULL;
+        watches->page_count--;
+        watches->ram_pages -= addr <= 0x1fff;
+    }
+}
+
+// frees the table once nothing is watched or left to drain, returning every access to the fast path
+static void drop_unused_watches(NES *nes) {
+    Watches *watches = nes->watches;
+    if (watches && !watches->page_count && !watches->pending && !watches->dropped) {
+        delete_watches(watches);
+        nes->watches = NULL;
+    }
+}
+
+// watches addr for the given kinds, replacing those set before, 0 stops watching it
+// ram addresses are watched through all of their mirrors
+void set_watch(NES *nes, uint16_t addr, uint8_t kinds) {
+    if (!nes->watches) {
+        if (!kinds) {
+            return;
+        }
+        nes->watches = (Watches*) calloc(1, sizeof(Watches));
+    }
+
+    if (addr <= 0x1fff) {
+        for (uint16_t mirror = addr % NES_RAM_SIZE; mirror <= 0x1fff; mirror += NES_RAM_SIZE) {
+            watch_address(nes, mirror, kinds);
+        }
+    } else {
+        watch_address(nes, addr, kinds);
+    }
+    drop_unused_watches(nes);
+}
+
+void delete_watches(Watches *watches) {
+    if (watches) {
+        for (unsigned i = 0; i < 256; i++) {
+            free(watches->pages[i]);
+        }
+        free(watches);
+    }
+}
+
+static void record_watch(NES *nes, uint16_t addr, uint8_t kinds, uint8_t old_value, uint8_t value) {
+    Watches *watches = nes->watches;
+    if (watches->halt) {
+        halt_nes(nes, NES_DEBUG_STOP);
+    }
+    if (watches->pending == WATCH_EVENT_CAPACITY) {
+        watches->dropped++;
+        return;
+    }
+    watches->events[watches->pending++] = (WatchEvent) {
+        nes->cpu.cycles, nes->ppu.frame, addr, nes->cpu.program_c, kinds, old_value, value
+    };
+}
+
+// slow path of a read from a watched page, value is what the read returned
+void watch_read(NES *nes, uint16_t addr, uint8_t value) {
+    if (nes->watches->pages[addr >> 8]->kinds[addr & 0xff] & WATCH_READ) {
+        record_watch(nes, addr, WATCH_READ, 0, value);
+    }
+}
+
+// slow path of a write to a watched page, called before the value is stored
+void watch_write(NES *nes, uint16_t addr, uint8_t value) {
+    WatchPage *page = nes->watches->pages[addr >> 8];
+    uint8_t *last = &page->last[addr & 0xff];
+    uint8_t old_value = addr <= 0x1fff ? nes->ram[addr % NES_RAM_SIZE] : *last;
+    uint8_t kinds = page->kinds[addr & 0xff] & (WATCH_WRITE | (old_value != value ? WATCH_CHANGE : 0));
+    *last = value;
+    if (kinds) {
+        record_watch(nes, addr, kinds, old_value, value);
+    }
+}
+
+// moves up to capacity of the oldest buffered events to out, returns how many, dropped receives
+// the events lost to a full buffer since the previous drain
+unsigned take_watch_events(NES *nes, WatchEvent *out, unsigned capacity, uint64_t *dropped) {
+    Watches *watches = nes->watches;
+    if (!watches) {
+        *dropped = 0;
+        return 0;
+    }
+
+    unsigned count = watches->pending < capacity ? watches->pending : capacity;
+    memcpy(out, watches->events, count * sizeof(WatchEvent));
+    memmove(watches->events, watches->events + count, (watches->pending - count) * sizeof(WatchEvent));
+    watches->pending -= count;
+    *dropped = watches->dropped;
+    watches->dropped = 0;
+    drop_unused_watches(nes);
+    return count;
+}
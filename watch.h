@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define WATCH_READ 1
+#define WATCH_WRITE 2
+#define WATCH_CHANGE 4              // a write storing a different value than the one it replaces
+#define WATCH_EVENT_CAPACITY 4096   // events buffered between drains, later ones are only counted
+
+typedef struct NES NES;
+
+// one access matching a watch
+typedef struct WatchEvent {
+    uint64_t cycle;
+    uint32_t frame;         // ppu frame the access happened in
+    uint16_t addr;          // cpu address as accessed, ram mirrors are reported as such
+    uint16_t pc;            // program counter at the access, usually already past the accessing instruction
+    uint8_t kinds;          // watch kinds the access matched
+    uint8_t old_value;      // writes only
+    uint8_t value;
+} WatchEvent;
+
+// watch kinds of every address of one cpu page
+typedef struct WatchPage {
+    uint8_t kinds[256];
+    uint8_t last[256];      // last value written, what change watches compare against outside ram
+    unsigned watched;       // addresses with any kind set, the page is freed when it drops to 0
+} WatchPage;
+
+// page table of watched cpu pages, only accesses to pages with an entry leave the fast path,
+// the console holds no table at all while nothing is watched
+typedef struct Watches {
+    WatchPage *pages[256];
+    unsigned page_count;    // pages with an entry
+    unsigned ram_pages;     // watched pages below $2000, which recompiled blocks access directly
+    unsigned read_watches;  // addresses watched for reads, idle loops are not skipped while any exist
+    unsigned pending;       // events buffered since the last drain
+    uint64_t dropped;       // events lost to a full buffer since the last drain
+    bool halt;              // stop the console once an access matches, after its instruction completes
+    WatchEvent events[WATCH_EVENT_CAPACITY];
+} Watches;
+
+void set_watch(NES *nes, uint16_t addr, uint8_t kinds);
+void delete_watches(Watches *watches);
+void watch_read(NES *nes, uint16_t addr, uint8_t value);
+void watch_write(NES *nes, uint16_t addr, uint8_t value);
+unsigned take_watch_events(NES *nes, WatchEvent *out, unsigned capacity, uint64_t *dropped);
@@ -0,0 +1,511 @@
+#include "wide.h"
+#include "nes.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+WideNES *new_wide(const ROM *rom, unsigned lanes) {
+    WideNES *wide = (WideNES*) calloc(1, sizeof(WideNES));
+    wide->lanes = lanes;
+    wide->nes = (NES**) calloc(lanes, sizeof(NES*));
+    wide->acc = (uint8_t*) calloc(lanes, sizeof(uint8_t));
+    wide->x = (uint8_t*) calloc(lanes, sizeof(uint8_t));
+    wide->y = (uint8_t*) calloc(lanes, sizeof(uint8_t));
+    wide->status = (uint8_t*) calloc(lanes, sizeof(uint8_t));
+    wide->stack = (uint8_t*) calloc(lanes, sizeof(uint8_t));
+    wide->pcs = (uint16_t*) calloc(lanes, sizeof(uint16_t));
+    wide->cycles = (uint64_t*) calloc(lanes, sizeof(uint64_t));
+    wide->until = (uint64_t*) calloc(lanes, sizeof(uint64_t));
+    wide->addrs = (uint16_t*) calloc(lanes, sizeof(uint16_t));
+    wide->operands = (uint8_t*) calloc(lanes, sizeof(uint8_t));
+    wide->extra = (uint8_t*) calloc(lanes, sizeof(uint8_t));
+    wide->active = (uint8_t*) calloc(lanes, sizeof(uint8_t));
+    wide->matched = (uint8_t*) calloc(lanes, sizeof(uint8_t));
+    for (unsigned i = 0; i < lanes; i++) {
+        wide->nes[i] = new_NES(rom);
+    }
+
+    return wide;
+}
+
+void delete_wide(WideNES *wide) {
+    for (unsigned i = 0; i < wide->lanes; i++) {
+        delete_nes(wide->nes[i]);
+    }
+    free(wide->nes);
+    free(wide->acc);
+    free(wide->x);
+    free(wide->y);
+    free(wide->status);
+    free(wide->stack);
+    free(wide->pcs);
+    free(wide->cycles);
+    free(wide->until);
+    free(wide->addrs);
+    free(wide->operands);
+    free(wide->extra);
+    free(wide->active);
+    free(wide->matched);
+    free(wide);
+}
+
+// moves a lane's registers from its console into the register arrays
+static void load_lane(WideNES *wide, unsigned i) {
+    const CPU *cpu = &wide->nes[i]->cpu;
+    wide->acc[i] = cpu->acc_reg;
+    wide->x[i] = cpu->x_reg;
+    wide->y[i] = cpu->y_reg;
+    wide->status[i] = cpu->status_reg;
+    wide->stack[i] = cpu->stack_p;
+    wide->pcs[i] = cpu->program_c;
+    wide->cycles[i] = cpu->cycles;
+}
+
+// moves a lane's registers back into its console before anything scalar runs on it
+static void store_lane(const WideNES *wide, unsigned i) {
+    CPU *cpu = &wide->nes[i]->cpu;
+    cpu->acc_reg = wide->acc[i];
+    cpu->x_reg = wide->x[i];
+    cpu->y_reg = wide->y[i];
+    cpu->status_reg = wide->status[i];
+    cpu->stack_p = wide->stack[i];
+    cpu->program_c = wide->pcs[i];
+    cpu->cycles = wide->cycles[i];
+}
+
+// marks active lanes whose program counter equals pc
+static void match_lanes(WideNES *wide, uint16_t pc) {
+    unsigned i = 0;
+#ifdef __SSE2__
+    __m128i leader = _mm_set1_epi16((short) pc);
+    for (; i + 16 <= wide->lanes; i += 16) {
+        __m128i low = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*) (wide->pcs + i)), leader);
+        __m128i high = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*) (wide->pcs + i + 8)), leader);
+        __m128i idle = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (wide->active + i)), _mm_setzero_si128());
+        _mm_storeu_si128((__m128i*) (wide->matched + i), _mm_andnot_si128(idle, _mm_packs_epi16(low, high)));
+    }
+#endif
+    for (; i < wide->lanes; i++) {
+        wide->matched[i] = wide->active[i] && wide->pcs[i] == pc ? 0xff : 0;
+    }
+}
+
+typedef enum LANE_OP {
+    LANE_LOAD,  // register = value
+    LANE_AND,
+    LANE_ORA,
+    LANE_EOR,
+    LANE_INC,   // register + 1, value unused
+    LANE_DEC,   // register - 1, value unused
+    LANE_CMP    // flags of register - value, register kept
+} LANE_OP;
+
+#define ZN_FLAGS ((1 << ZERO) | (1 << NEGATIVE))
+#define CZN_FLAGS ((1 << CARRY) | ZN_FLAGS)
+
+// one lane of alu_lanes, the same flag rules as the exec_* handlers
+static void alu_lane(LANE_OP op, uint8_t *reg, uint8_t value, uint8_t *status) {
+    uint8_t result;
+    switch (op) {
+        case LANE_LOAD:
+            result = value;
+            break;
+        case LANE_AND:
+            result = *reg & value;
+            break;
+        case LANE_ORA:
+            result = *reg | value;
+            break;
+        case LANE_EOR:
+            result = *reg ^ value;
+            break;
+        case LANE_INC:
+            result = *reg + 1;
+            break;
+        case LANE_DEC:
+            result = *reg - 1;
+            break;
+        case LANE_CMP:
+        default:
+            *status = (*status & ~CZN_FLAGS) | (*reg >= value) << CARRY | (*reg == value) << ZERO |
+                ((uint8_t) (*reg - value) & (1 << NEGATIVE));
+            return;
+    }
+    *reg = result;
+    *status = (*status & ~ZN_FLAGS) | !result << ZERO | (result & (1 << NEGATIVE));
+}
+
+#ifdef __SSE2__
+static __m128i select_lanes(__m128i mask, __m128i updated, __m128i old) {
+    return _mm_or_si128(_mm_and_si128(mask, updated), _mm_andnot_si128(mask, old));
+}
+#endif
+
+// applies op to reg of every matched lane, sixteen lanes per vector
+static void alu_lanes(WideNES *wide, LANE_OP op, uint8_t *reg, const uint8_t *values) {
+    unsigned i = 0;
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i negative = _mm_set1_epi8((char) (1 << NEGATIVE));
+    for (; i + 16 <= wide->lanes; i += 16) {
+        __m128i mask = _mm_loadu_si128((const __m128i*) (wide->matched + i));
+        __m128i r = _mm_loadu_si128((const __m128i*) (reg + i));
+        __m128i v = _mm_loadu_si128((const __m128i*) (values + i));
+        __m128i p = _mm_loadu_si128((const __m128i*) (wide->status + i));
+        __m128i result;
+        switch (op) {
+            case LANE_LOAD:
+                result = v;
+                break;
+            case LANE_AND:
+                result = _mm_and_si128(r, v);
+                break;
+            case LANE_ORA:
+                result = _mm_or_si128(r, v);
+                break;
+            case LANE_EOR:
+                result = _mm_xor_si128(r, v);
+                break;
+            case LANE_INC:
+                result = _mm_sub_epi8(r, _mm_set1_epi8(-1));
+                break;
+            case LANE_DEC:
+                result = _mm_add_epi8(r, _mm_set1_epi8(-1));
+                break;
+            case LANE_CMP:
+            default: {
+                __m128i carry = _mm_and_si128(_mm_cmpeq_epi8(_mm_max_epu8(r, v), r), _mm_set1_epi8(1 << CARRY));
+                __m128i equal = _mm_and_si128(_mm_cmpeq_epi8(r, v), _mm_set1_epi8(1 << ZERO));
+                __m128i sign = _mm_and_si128(_mm_sub_epi8(r, v), negative);
+                __m128i flags = _mm_or_si128(_mm_andnot_si128(_mm_set1_epi8(CZN_FLAGS), p),
+                        _mm_or_si128(carry, _mm_or_si128(equal, sign)));
+                _mm_storeu_si128((__m128i*) (wide->status + i), select_lanes(mask, flags, p));
+                continue;
+            }
+        }
+        __m128i flags = _mm_or_si128(_mm_andnot_si128(_mm_set1_epi8(ZN_FLAGS), p),
+                _mm_or_si128(_mm_and_si128(_mm_cmpeq_epi8(result, zero), _mm_set1_epi8(1 << ZERO)),
+                    _mm_and_si128(result, negative)));
+        _mm_storeu_si128((__m128i*) (reg + i), select_lanes(mask, result, r));
+        _mm_storeu_si128((__m128i*) (wide->status + i), select_lanes(mask, flags, p));
+    }
+#endif
+    for (; i < wide->lanes; i++) {
+        if (wide->matched[i]) {
+            alu_lane(op, &reg[i], values[i], &wide->status[i]);
+        }
+    }
+}
+
+// resolves the operand of inst for every matched lane, returns false without touching any lane when
+// one of them would access memory outside ram or a watched page, which only exec_inst handles
+static bool gather_operands(WideNES *wide, const Inst *inst) {
+    uint16_t base = (inst->body[1] << 8) | inst->body[0];
+    for (unsigned i = 0; i < wide->lanes; i++) {
+        if (!wide->matched[i]) {
+            continue;
+        }
+        uint16_t addr;
+        wide->extra[i] = 0;
+        switch (inst->addr_mode) {
+            case IMPLIED:
+                continue;
+            case IMMEDIATE:
+            case RELATIVE:
+                wide->operands[i] = inst->body[0];
+                continue;
+            case ZERO_PAGE:
+                addr = inst->body[0];
+                break;
+            case ZERO_PAGE_X:
+                addr = (inst->body[0] + wide->x[i]) % ZERO_PAGE_SIZE;
+                break;
+            case ZERO_PAGE_Y:
+                addr = (inst->body[0] + wide->y[i]) % ZERO_PAGE_SIZE;
+                break;
+            case ABSOLUTE:
+                addr = base;
+                break;
+            case ABSOLUTE_X:
+                addr = base + wide->x[i];
+                wide->extra[i] = page_crossed(base, addr) ? inst->page_cross_cycles : 0;
+                break;
+            case ABSOLUTE_Y:
+                addr = base + wide->y[i];
+                wide->extra[i] = page_crossed(base, addr) ? inst->page_cross_cycles : 0;
+                break;
+            default:
+                return false;
+        }
+
+        const NES *nes = wide->nes[i];
+        if (addr > 0x1fff || (nes->watches && nes->watches->pages[addr >> 8])) {
+            return false;
+        }
+        wide->addrs[i] = addr;
+        wide->operands[i] = nes->ram[addr % NES_RAM_SIZE];
+    }
+    return true;
+}
+
+static void store_lanes(WideNES *wide, const uint8_t *reg) {
+    for (unsigned i = 0; i < wide->lanes; i++) {
+        if (wide->matched[i]) {
+            wide->nes[i]->ram[wide->addrs[i] % NES_RAM_SIZE] = reg[i];
+            mark_ram_dirty(wide->nes[i], wide->addrs[i] % NES_RAM_SIZE);
+        }
+    }
+}
+
+static void flag_lanes(WideNES *wide, STATUS_REG_BIT bit, bool value) {
+    for (unsigned i = 0; i < wide->lanes; i++) {
+        if (wide->matched[i]) {
+            wide->status[i] = (wide->status[i] & ~(1 << bit)) | value << bit;
+        }
+    }
+}
+
+// program counters already point past the branch, as exec_branch expects
+static void branch_lanes(WideNES *wide, const Inst *inst, STATUS_REG_BIT bit, bool condition) {
+    for (unsigned i = 0; i < wide->lanes; i++) {
+        if (wide->matched[i] && (wide->status[i] >> bit & 1) == condition) {
+            uint16_t target = wide->pcs[i] + (int8_t) inst->body[0];
+            wide->extra[i] = inst->branch_succeeds_cycles +
+                (page_crossed(wide->pcs[i], target) ? inst->page_cross_cycles : 0);
+            wide->pcs[i] = target;
+        }
+    }
+}
+
+// executes inst on the register arrays of every matched lane, returns false without touching any
+// lane when the instruction is left to exec_inst
+static bool issue_lanes(WideNES *wide, const Inst *inst, uint16_t pc) {
+    if (inst->fused == FUSE_BREAKPOINT) {
+        return false;
+    }
+    switch (inst->inst_type) { // instructions with a lockstep form, checked before any lane changes
+        case LDA_OP: case LDX_OP: case LDY_OP:
+        case AND_OP: case ORA_OP: case EOR_OP:
+        case CMP_OP: case CPX_OP: case CPY_OP:
+        case INX_OP: case INY_OP: case DEX_OP: case DEY_OP:
+        case TAX_OP: case TAY_OP: case TXA_OP: case TYA_OP: case TSX_OP: case TXS_OP:
+        case STA_OP: case STX_OP: case STY_OP:
+        case CLC_OP: case SEC_OP: case CLV_OP:
+        case BCC_OP: case BCS_OP: case BEQ_OP: case BNE_OP:
+        case BMI_OP: case BPL_OP: case BVC_OP: case BVS_OP:
+        case NOP:
+            break;
+        case JMP_OP:
+            if (inst->addr_mode == ABSOLUTE) {
+                break;
+            }
+            return false;
+        default:
+            return false;
+    }
+    if (inst->inst_type != JMP_OP && !gather_operands(wide, inst)) {
+        return false;
+    }
+
+    for (unsigned i = 0; i < wide->lanes; i++) {
+        if (wide->matched[i]) {
+            wide->pcs[i] = pc + inst->size_bytes;
+        }
+    }
+    switch (inst->inst_type) {
+        case LDA_OP: alu_lanes(wide, LANE_LOAD, wide->acc, wide->operands); break;
+        case LDX_OP: alu_lanes(wide, LANE_LOAD, wide->x, wide->operands); break;
+        case LDY_OP: alu_lanes(wide, LANE_LOAD, wide->y, wide->operands); break;
+        case AND_OP: alu_lanes(wide, LANE_AND, wide->acc, wide->operands); break;
+        case ORA_OP: alu_lanes(wide, LANE_ORA, wide->acc, wide->operands); break;
+        case EOR_OP: alu_lanes(wide, LANE_EOR, wide->acc, wide->operands); break;
+        case CMP_OP: alu_lanes(wide, LANE_CMP, wide->acc, wide->operands); break;
+        case CPX_OP: alu_lanes(wide, LANE_CMP, wide->x, wide->operands); break;
+        case CPY_OP: alu_lanes(wide, LANE_CMP, wide->y, wide->operands); break;
+        case INX_OP: alu_lanes(wide, LANE_INC, wide->x, wide->x); break;
+        case INY_OP: alu_lanes(wide, LANE_INC, wide->y, wide->y); break;
+        case DEX_OP: alu_lanes(wide, LANE_DEC, wide->x, wide->x); break;
+        case DEY_OP: alu_lanes(wide, LANE_DEC, wide->y, wide->y); break;
+        case TAX_OP: alu_lanes(wide, LANE_LOAD, wide->x, wide->acc); break;
+        case TAY_OP: alu_lanes(wide, LANE_LOAD, wide->y, wide->acc); break;
+        case TXA_OP: alu_lanes(wide, LANE_LOAD, wide->acc, wide->x); break;
+        case TYA_OP: alu_lanes(wide, LANE_LOAD, wide->acc, wide->y); break;
+        case TSX_OP: alu_lanes(wide, LANE_LOAD, wide->x, wide->stack); break;
+        case TXS_OP:
+            for (unsigned i = 0; i < wide->lanes; i++) {
+                wide->stack[i] = wide->matched[i] ? wide->x[i] : wide->stack[i];
+            }
+            break;
+        case STA_OP: store_lanes(wide, wide->acc); break;
+        case STX_OP: store_lanes(wide, wide->x); break;
+        case STY_OP: store_lanes(wide, wide->y); break;
+        case CLC_OP: flag_lanes(wide, CARRY, 0); break;
+        case SEC_OP: flag_lanes(wide, CARRY, 1); break;
+        case CLV_OP: flag_lanes(wide, OVERFLOW, 0); break;
+        case BCC_OP: branch_lanes(wide, inst, CARRY, 0); break;
+        case BCS_OP: branch_lanes(wide, inst, CARRY, 1); break;
+        case BEQ_OP: branch_lanes(wide, inst, ZERO, 1); break;
+        case BNE_OP: branch_lanes(wide, inst, ZERO, 0); break;
+        case BMI_OP: branch_lanes(wide, inst, NEGATIVE, 1); break;
+        case BPL_OP: branch_lanes(wide, inst, NEGATIVE, 0); break;
+        case BVC_OP: branch_lanes(wide, inst, OVERFLOW, 0); break;
+        case BVS_OP: branch_lanes(wide, inst, OVERFLOW, 1); break;
+        case JMP_OP:
+            for (unsigned i = 0; i < wide->lanes; i++) {
+                wide->pcs[i] = wide->matched[i] ? (inst->body[1] << 8) | inst->body[0] : wide->pcs[i];
+                wide->extra[i] = 0;
+            }
+            break;
+        default:
+            break;
+    }
+
+    for (unsigned i = 0; i < wide->lanes; i++) {
+        if (!wide->matched[i]) {
+            continue;
+        }
+        wide->cycles[i] += inst->cycles + wide->extra[i];
+        wide->nes[i]->cpu.insts++;
+        if (wide->pcs[i] <= pc) { // backward jump, the idle loop detector works on the console
+            store_lane(wide, i);
+            fast_forward_idle_loop(wide->nes[i], pc);
+            wide->cycles[i] = wide->nes[i]->cpu.cycles;
+        }
+    }
+    return true;
+}
+
+// mirrors run_frame's batch boundaries for one lane, returns false once its frame is complete
+static bool refill_lane(NES *nes, uint64_t until) {
+    for (;;) {
+        sync_components(nes);
+        if (nes->cpu.cycles >= until || nes->status != NES_OK) {
+            return false;
+        }
+        begin_batch(nes, until);
+        if (nes->cpu.cycles < nes->batch_end) {
+            return true;
+        }
+    }
+}
+
+// scalar step of a lane that diverged, or whose instruction has no lockstep form
+static void step_lane(WideNES *wide, unsigned i, const Inst *inst) {
+    NES *nes = wide->nes[i];
+    uint16_t pc = wide->pcs[i];
+    store_lane(wide, i);
+    if (inst) { // decoded from rom by the leading lane
+        issue_inst(nes, inst);
+    } else {
+        step_cpu(nes);
+    }
+    if (nes->cpu.program_c <= pc) {
+        fast_forward_idle_loop(nes, pc);
+    }
+    load_lane(wide, i);
+}
+
+// runs every lane until its ppu finishes the current frame, producing the same state as
+// calling run_frame on each lane separately
+void run_wide_frame(WideNES *wide) {
+    unsigned remaining = 0;
+    for (unsigned i = 0; i < wide->lanes; i++) {
+        start_dirty_frame(wide->nes[i]);
+        wide->until[i] = frame_end_cycle(wide->nes[i]);
+        wide->active[i] = refill_lane(wide->nes[i], wide->until[i]);
+        load_lane(wide, i);
+        remaining += wide->active[i];
+    }
+
+    while (remaining) {
+        unsigned leader = 0;
+        while (!wide->active[leader]) {
+            leader++;
+        }
+        uint16_t pc = wide->pcs[leader];
+        match_lanes(wide, pc);
+
+        Inst scratch;
+        const Inst *inst = fetch_inst(wide->nes[leader], pc, &scratch);
+        bool shareable = inst != &scratch; // decoded from rom, identical for every lane
+        bool lockstep = shareable && !wide->nes[leader]->rom->cycle_stepped && issue_lanes(wide, inst, pc);
+        wide->steps++;
+
+        for (unsigned i = 0; i < wide->lanes; i++) {
+            if (!wide->active[i]) {
+                continue;
+            }
+            bool matched = wide->matched[i];
+            if (!(lockstep && matched)) {
+                step_lane(wide, i, matched && shareable ? inst : NULL);
+            }
+            wide->lane_steps++;
+            wide->matched_steps += lockstep && matched;
+
+            if (wide->cycles[i] >= wide->nes[i]->batch_end) {
+                store_lane(wide, i);
+                wide->active[i] = refill_lane(wide->nes[i], wide->until[i]);
+                load_lane(wide, i);
+                remaining -= !wide->active[i];
+            }
+        }
+    }
+}
+
+// fraction of issued instructions that executed in lockstep
+double wide_utilization(const WideNES *wide) {
+    return wide->lane_steps ? (double) wide->matched_steps / wide->lane_steps : 0;
+}
+
+static double elapsed_seconds(const struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// compares aggregate instructions per second of lockstep lanes against independent instances,
+// every lane holds different buttons so that lanes drift apart as rollouts do
+void bench_wide(const ROM *rom, unsigned lanes, unsigned frames) {
+    struct timespec start;
+    uint64_t insts = 0;
+
+    NES **independent = (NES**) calloc(lanes, sizeof(NES*));
+    for (unsigned i = 0; i < lanes; i++) {
+        independent[i] = new_NES(rom);
+        independent[i]->controllers[0].buttons = (uint8_t) i;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (unsigned f = 0; f < frames; f++) {
+        for (unsigned i = 0; i < lanes; i++) {
+            run_frame(independent[i]);
+        }
+    }
+    double independent_time = elapsed_seconds(&start);
+    for (unsigned i = 0; i < lanes; i++) {
+        insts += independent[i]->cpu.insts;
+        delete_nes(independent[i]);
+    }
+    free(independent);
+    printf("independent: %u instances, %.0f instructions/s\n", lanes, insts / independent_time);
+
+    WideNES *wide = new_wide(rom, lanes);
+    for (unsigned i = 0; i < lanes; i++) {
+        wide->nes[i]->controllers[0].buttons = (uint8_t) i;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (unsigned f = 0; f < frames; f++) {
+        run_wide_frame(wide);
+    }
+    double wide_time = elapsed_seconds(&start);
+    insts = 0;
+    for (unsigned i = 0; i < lanes; i++) {
+        insts += wide->nes[i]->cpu.insts;
+    }
+    printf("lockstep: %u lanes, %.0f instructions/s, %.1f%% lane utilization\n",
+            lanes, insts / wide_time, 100 * wide_utilization(wide));
+    delete_wide(wide);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct NES NES;
+typedef struct ROM ROM;
+
+// lockstep execution of many instances of one rom
+// cpu registers are kept as structure of arrays, lanes whose program counters agree execute the
+// instruction together on those arrays, lanes that diverge fall back to exec_inst on their own console
+typedef struct WideNES {
+    unsigned lanes;
+    NES **nes;                  // memory and components of every lane
+    uint8_t *acc;               // registers of every lane, owned by the arrays while a frame runs
+    uint8_t *x;
+    uint8_t *y;
+    uint8_t *status;
+    uint8_t *stack;
+    uint16_t *pcs;
+    uint64_t *cycles;
+    uint64_t *until;            // cycle at which each lane's frame is complete
+    uint16_t *addrs;            // scratch: memory address of the lockstep instruction's operand per lane
+    uint8_t *operands;          // scratch: operand value per lane
+    uint8_t *extra;             // scratch: page crossing and taken branch cycles per lane
+    uint8_t *active;            // lane still has cycles left in its current frame
+    uint8_t *matched;           // 0xff where the lane agrees with the leading lane this step
+    uint64_t steps;             // lockstep steps taken
+    uint64_t lane_steps;        // instructions issued across all active lanes
+    uint64_t matched_steps;     // instructions executed in lockstep on the register arrays
+} WideNES;
+
+WideNES *new_wide(const ROM *rom, unsigned lanes);
+void delete_wide(WideNES *wide);
+void run_wide_frame(WideNES *wide);
+double wide_utilization(const WideNES *wide);
+void bench_wide(const ROM *rom, unsigned lanes, unsigned frames);